@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "BatterySysfs.h"
+
+#include <SafeStoi.h>
+
+#include <log/log.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+static const char kCapacitySysfs[] = "/sys/class/power_supply/battery/capacity";
+static const char kStatusSysfs[] = "/sys/class/power_supply/battery/status";
+
+static const struct {
+  const char *name;
+  BatterySysfs::Status status;
+} kStatusNames[] = {
+  {"Charging", BatterySysfs::Status::CHARGING},
+  {"Discharging", BatterySysfs::Status::DISCHARGING},
+  {"Not charging", BatterySysfs::Status::NOT_CHARGING},
+  {"Full", BatterySysfs::Status::FULL},
+};
+
+/**
+ * Read a sysfs node from the start, without its trailing newline
+ *
+ * @return false on error
+ */
+static bool preadNode(const int fd, std::string *out) {
+  char buf[32];
+  ssize_t len;
+
+  // sysfs regenerates the value on every read at offset 0
+  do {
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+  } while (len < 0 && errno == EINTR);
+  if (len <= 0)
+    return false;
+  while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\0'))
+    len--;
+  out->assign(buf, len);
+  return true;
+}
+
+bool BatterySysfs::open(void) {
+  capacityFd.reset(::open(kCapacitySysfs, O_RDONLY | O_CLOEXEC));
+  if (capacityFd < 0) {
+    ALOGW("%s: Failed to open '%s': %s", __func__, kCapacitySysfs, strerror(errno));
+    return false;
+  }
+  statusFd.reset(::open(kStatusSysfs, O_RDONLY | O_CLOEXEC));
+  if (statusFd < 0) {
+    ALOGW("%s: Failed to open '%s': %s", __func__, kStatusSysfs, strerror(errno));
+    capacityFd.reset();
+    return false;
+  }
+  return true;
+}
+
+bool BatterySysfs::read(int *capacity, Status *status) const {
+  std::string value;
+
+  if (!isOpen())
+    return false;
+  if (!preadNode(capacityFd.get(), &value))
+    return false;
+  *capacity = stoi_safe(value);
+  if (*capacity < 0)
+    return false;
+  if (!preadNode(statusFd.get(), &value))
+    return false;
+  *status = Status::UNKNOWN;
+  for (const auto &entry : kStatusNames) {
+    if (value == entry.name) {
+      *status = entry.status;
+      break;
+    }
+  }
+  return true;
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+/**
+ * Reads battery capacity and charge status straight from the power_supply
+ * class, the nodes the health HAL reports anyway. The nodes are kept open
+ * and read with pread(), so concurrent readers need no lock.
+ */
+class BatterySysfs {
+  public:
+    // Same names as the health HAL's BatteryStatus
+    enum class Status {
+        UNKNOWN,
+        CHARGING,
+        DISCHARGING,
+        NOT_CHARGING,
+        FULL,
+    };
+
+    /**
+     * Open the capacity and status nodes
+     *
+     * @return true if both could be opened
+     */
+    bool open(void);
+
+    // Whether open() succeeded
+    bool isOpen(void) const { return capacityFd >= 0 && statusFd >= 0; }
+
+    /**
+     * Read capacity and charge status
+     *
+     * @param capacity set to the capacity in percent
+     * @param status set to the charge status, UNKNOWN if not recognised
+     * @return true on success, false if a node could not be read
+     */
+    bool read(int *capacity, Status *status) const;
+
+  private:
+    ::android::base::unique_fd capacityFd;
+    ::android::base::unique_fd statusFd;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
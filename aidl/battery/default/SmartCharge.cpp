@@ -10,12 +10,18 @@
 #include <GetServiceSupport.h>
 #include <SafeStoi.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/properties.h>
 #include <hidl/HidlTransportSupport.h>
 #include <log/log.h>
 
 #include <chrono>
+#include <cinttypes>
+#include <cstring>
 #include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <functional>
 #include <sstream>
 #include <type_traits>
@@ -26,7 +32,9 @@ namespace samsung_ext {
 namespace framework {
 namespace battery {
 
+using ::android::base::GetBoolProperty;
 using ::android::base::GetProperty;
+using ::android::base::GetUintProperty;
 using ::android::base::SetProperty;
 
 using ScopedLock = const std::lock_guard<std::mutex>;
@@ -35,9 +43,19 @@ using namespace std::chrono_literals;
 
 static constexpr int kInvalidCfg = -1;
 
+// Re-read the battery at most this often, in case the health HAL misses a change
+static constexpr auto kPushPollInterval = 10min;
+// Without health HAL callbacks, poll at most this often, to notice a charger
+static constexpr auto kMaxPollInterval = 1min;
+// Near a limit, poll this often
+static constexpr auto kPollInterval = 5s;
+
 static const char kSmartChargeConfigProp[] = "persist.ext.smartcharge.config";
 static const char kSmartChargeEnabledProp[] = "persist.ext.smartcharge.enabled";
 static const char kSmartChargeOverrideProp[] = "ro.hardware.battery";
+static const char kSmartChargeSysfsProp[] = "persist.ext.smartcharge.sysfs";
+static const char kSmartChargeWakeAlarmProp[] = "persist.ext.smartcharge.wake_alarm";
+static const char kSmartChargeTimerSlackProp[] = "persist.ext.smartcharge.timer_slack_ms";
 static const char kComma = ',';
 
 template <typename T>
@@ -118,6 +136,11 @@ void SmartCharge::loadHealthImpl(void) {
       auto ret = health_hidl->linkToDeath(hidl_death_recp, reinterpret_cast<uint64_t>(this));
       linkToDeathSuccess = ret.isOk();
       reason = ret.description();
+      if (hidl_info_callback == nullptr)
+        hidl_info_callback = new hidl_health_info_callback(this);
+      auto cbret = health_hidl->registerCallback(hidl_info_callback);
+      healthCallbackRegistered = cbret.isOk() &&
+          cbret == ::android::hardware::health::V2_0::Result::SUCCESS;
     } else {
       LOG_ALWAYS_FATAL("Failed to connect to any valid health HAL");
     }
@@ -130,9 +153,61 @@ void SmartCharge::loadHealthImpl(void) {
     auto ret = AIBinder_linkToDeath(health_aidl->asBinder().get(), aidl_death_recp.get(), this);
     linkToDeathSuccess = ret == STATUS_OK;
     reason = ndk::ScopedAStatus(AStatus_fromStatus(ret)).getDescription();
+    if (aidl_info_callback == nullptr)
+      aidl_info_callback = ndk::SharedRefBase::make<aidl_health_info_callback>(this);
+    healthCallbackRegistered = health_aidl->registerCallback(aidl_info_callback).isOk();
   }
   if (!linkToDeathSuccess)
     ALOGW("%s: linkToDeath failed: %s", __func__, reason.c_str());
+  if (!healthCallbackRegistered)
+    ALOGW("%s: Failed to register health info callback, polling", __func__);
+}
+
+template <typename T>
+void SmartCharge::setChargeStatus(T halStatus, BatteryState *state) {
+  switch (halStatus) {
+  case T::CHARGING:
+  case T::FULL:
+    state->charge = ChargeStatus::ON;
+    state->chargeKnown = true;
+    break;
+  case T::DISCHARGING:
+  case T::NOT_CHARGING:
+    state->charge = ChargeStatus::OFF;
+    state->chargeKnown = true;
+    break;
+  default:
+    state->chargeKnown = false;
+    break;
+  };
+}
+
+void SmartCharge::onBatteryStateChanged(const BatteryState &state) {
+  {
+    ScopedLock _(kPushLock);
+    // The HAL also pushes periodically, only wake the loop on changes
+    if (state == pushedState)
+      return;
+    pushedState = state;
+    pushPending = true;
+  }
+  signalLoop();
+}
+
+ndk::ScopedAStatus aidl_health_info_callback::healthInfoChanged(
+    const ::aidl::android::hardware::health::HealthInfo& info) {
+  SmartCharge::BatteryState state{info.batteryLevel, SmartCharge::ChargeStatus::OFF, false};
+  SmartCharge::setChargeStatus(info.batteryStatus, &state);
+  mSmartCharge->onBatteryStateChanged(state);
+  return ndk::ScopedAStatus::ok();
+}
+
+::android::hardware::Return<void> hidl_health_info_callback::healthInfoChanged(
+    const ::android::hardware::health::V2_0::HealthInfo& info) {
+  SmartCharge::BatteryState state{info.legacy.batteryLevel, SmartCharge::ChargeStatus::OFF, false};
+  SmartCharge::setChargeStatus(info.legacy.batteryStatus, &state);
+  mSmartCharge->onBatteryStateChanged(state);
+  return ::android::hardware::Void();
 }
 
 bool SmartCharge::loadAndParseConfigProp(void) {
@@ -198,11 +273,78 @@ void SmartCharge::loadEnabledAndStart(void) {
   }
 }
 
+bool SmartCharge::initLoopFds(void) {
+  struct epoll_event ev {};
+
+  timerSlack = std::chrono::milliseconds(
+      GetUintProperty<uint32_t>(kSmartChargeTimerSlackProp, 1000));
+  // Needs CAP_WAKE_ALARM, and CAP_BLOCK_SUSPEND to stay awake for it
+  if (GetBoolProperty(kSmartChargeWakeAlarmProp, false)) {
+    timerFd.reset(timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_CLOEXEC | TFD_NONBLOCK));
+    if (timerFd < 0)
+      ALOGW("%s: CLOCK_BOOTTIME_ALARM timer: %s, not waking up", __func__, strerror(errno));
+    timerWakesUp = timerFd >= 0;
+  }
+  // Keeps counting in suspend, unlike the steady clock
+  if (timerFd < 0)
+    timerFd.reset(timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK));
+  eventFd.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  epollFd.reset(epoll_create1(EPOLL_CLOEXEC));
+  if (timerFd < 0 || eventFd < 0 || epollFd < 0) {
+    ALOGE("%s: Failed to create loop fds: %s", __func__, strerror(errno));
+    return false;
+  }
+  for (const int fd : {timerFd.get(), eventFd.get()}) {
+    ev.events = EPOLLIN;
+    // An alarm wakes the device up, but only EPOLLWAKEUP keeps it up until
+    // the expiry is handled, that is until the next epoll_wait().
+    // Needs CAP_BLOCK_SUSPEND, silently ignored otherwise.
+    if (fd == timerFd.get() && timerWakesUp)
+      ev.events |= EPOLLWAKEUP;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      ALOGE("%s: epoll_ctl: %s", __func__, strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+void SmartCharge::armLoopTimer(std::chrono::milliseconds interval) {
+  using std::chrono::nanoseconds;
+  struct itimerspec spec {};
+  struct timespec now {};
+
+  // An absolute expiry on a multiple of the slack, shared by every timer
+  // using the same slack, so their wakeups coalesce. timerfd has no slack
+  // of its own.
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  auto expiry = nanoseconds(now.tv_sec * 1000000000LL + now.tv_nsec) + interval;
+  const auto slack = std::chrono::duration_cast<nanoseconds>(timerSlack);
+  if (slack.count() > 0)
+    expiry = (expiry + slack - nanoseconds(1)) / slack * slack;
+  spec.it_value.tv_sec = expiry.count() / 1000000000LL;
+  spec.it_value.tv_nsec = expiry.count() % 1000000000LL;
+  if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    ALOGE("%s: timerfd_settime: %s", __func__, strerror(errno));
+}
+
+void SmartCharge::signalLoop(void) {
+  const uint64_t one = 1;
+  if (eventFd >= 0 && write(eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    ALOGE("%s: eventfd write: %s", __func__, strerror(errno));
+}
+
 SmartCharge::SmartCharge(void) {
   bool ret;
 
+  // First, health HAL callbacks signal the loop
+  if (!initLoopFds())
+    LOG_ALWAYS_FATAL("Failed to set up the loop");
   loadHealthImpl();
   loadImplLibrary();
+  if (GetBoolProperty(kSmartChargeSysfsProp, true) && sysfs.open())
+    ALOGD("%s: Reading battery from sysfs", __func__);
 
   ret = loadAndParseConfigProp();
   if (ret) {
@@ -210,90 +352,111 @@ SmartCharge::SmartCharge(void) {
   }
 }
 
-void SmartCharge::startLoop(bool withrestart) {
-  ChargeStatus current, policy;
-  bool skip = false;
+void SmartCharge::readBatteryState(BatteryState *state) {
+  if (!readBatteryStateSysfs(state))
+    readBatteryStateHal(state);
+}
 
-  ALOGD("%s: ++", __func__);
-  std::unique_lock<std::mutex> lock(kCVLock);
-  while (true) {
-    int per;
+bool SmartCharge::readBatteryStateSysfs(BatteryState *state) {
+  BatterySysfs::Status sysfs_status;
+  int per;
+
+  if (!sysfs.isOpen())
+    return false;
+  if (!sysfs.read(&per, &sysfs_status)) {
+    ALOGW("%s: Failed to read battery from sysfs, using health HAL", __func__);
+    return false;
+  }
+  state->capacity = per;
+  setChargeStatus(sysfs_status, state);
+  return true;
+}
 
-    switch (healthState) {
-    case USE_HEALTH_AIDL: {
-      using android::hardware::health::BatteryStatus;
+void SmartCharge::readBatteryStateHal(BatteryState *state) {
+  int per = -1;
 
-      ScopedLock _(hal_health_lock);
-      BatteryStatus status_aidl = BatteryStatus::UNKNOWN;
-      auto ret = health_aidl->getCapacity(&per);
-      if (!ret.isOk()) {
-	per = ret.getStatus();
-        break;
-      }
-      ret = health_aidl->getChargeStatus(&status_aidl);
-      if (!ret.isOk()) {
-	per = ret.getStatus();
-        break;
-      }
-      switch (status_aidl) {
-      case BatteryStatus::CHARGING:
-      case BatteryStatus::FULL:
-        current = ChargeStatus::ON;
-        break;
-      case BatteryStatus::DISCHARGING:
-      case BatteryStatus::NOT_CHARGING:
-        current = ChargeStatus::OFF;
-	break;
-      default:
-        break;
-      };
+  state->chargeKnown = false;
+  switch (healthState) {
+  case USE_HEALTH_AIDL: {
+    using android::hardware::health::BatteryStatus;
+
+    ScopedLock _(hal_health_lock);
+    BatteryStatus status_aidl = BatteryStatus::UNKNOWN;
+    auto ret = health_aidl->getCapacity(&per);
+    if (!ret.isOk()) {
+      per = ret.getStatus();
       break;
     }
-    case USE_HEALTH_HIDL: {
-      using ::android::hardware::health::V2_0::Result;
-      using ::android::hardware::health::V1_0::BatteryStatus;
-
-      ScopedLock _(hal_health_lock);
-      Result res = Result::UNKNOWN;
-      BatteryStatus status_hidl = BatteryStatus::UNKNOWN;
-      health_hidl->getCapacity([&res, &per](Result hal_res, int32_t hal_value) {
-        res = hal_res;
-        per = hal_value;
-      });
-      if (res != Result::SUCCESS) {
-        per = -(static_cast<int>(res));
-        break;
-      }
-      health_hidl->getChargeStatus([&res, &status_hidl](Result hal_res, BatteryStatus hal_value) {
-        res = hal_res;
-        status_hidl = hal_value;
-      });
-      if (res != Result::SUCCESS) {
-        per = -(static_cast<int>(res));
-        break;
-      }
-      switch (status_hidl) {
-      case BatteryStatus::CHARGING:
-      case BatteryStatus::FULL:
-        current = ChargeStatus::ON;
-        break;
-      case BatteryStatus::DISCHARGING:
-      case BatteryStatus::NOT_CHARGING:
-        current = ChargeStatus::OFF;
-        break;
-      default:
-        break;
-      };
+    ret = health_aidl->getChargeStatus(&status_aidl);
+    if (!ret.isOk()) {
+      per = ret.getStatus();
+      break;
+    }
+    setChargeStatus(status_aidl, state);
+    break;
+  }
+  case USE_HEALTH_HIDL: {
+    using ::android::hardware::health::V2_0::Result;
+    using ::android::hardware::health::V1_0::BatteryStatus;
+
+    ScopedLock _(hal_health_lock);
+    Result res = Result::UNKNOWN;
+    BatteryStatus status_hidl = BatteryStatus::UNKNOWN;
+    health_hidl->getCapacity([&res, &per](Result hal_res, int32_t hal_value) {
+      res = hal_res;
+      per = hal_value;
+    });
+    if (res != Result::SUCCESS) {
+      per = -(static_cast<int>(res));
       break;
     }
-    default:
-      __builtin_unreachable();
+    health_hidl->getChargeStatus([&res, &status_hidl](Result hal_res, BatteryStatus hal_value) {
+      res = hal_res;
+      status_hidl = hal_value;
+    });
+    if (res != Result::SUCCESS) {
+      per = -(static_cast<int>(res));
+      break;
     }
+    setChargeStatus(status_hidl, state);
+    break;
+  }
+  default:
+    __builtin_unreachable();
+  }
+  state->capacity = per;
+}
+
+void SmartCharge::startLoop(bool withrestart) {
+  ChargeStatus current = ChargeStatus::ON, policy = ChargeStatus::ON;
+  BatteryState state{};
+  WakePredictor predictor;
+  bool skip = false;
+
+  ALOGD("%s: ++", __func__);
+  // The HAL only pushes changes, start from a fresh reading
+  {
+    ScopedLock _(kPushLock);
+    pushPending = false;
+  }
+  readBatteryState(&state);
+  while (true) {
+    const int per = state.capacity;
+
     if (per < 0) {
       SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
       ALOGE("%s: exit loop: retval: %d", __func__, per);
       break;
     }
+    if (state.chargeKnown) {
+      // The rate changes direction with the charge status
+      if (state.charge != current)
+        predictor.reset();
+      current = state.charge;
+    }
+    // Includes suspend, the battery drains meanwhile
+    predictor.addSample(per, std::chrono::duration_cast<WakePredictor::Duration>(
+        ::android::base::boot_clock::now().time_since_epoch()));
     if (per > upper)
       policy = ChargeStatus::OFF;
     else if (withrestart && per < lower)
@@ -318,19 +481,64 @@ void SmartCharge::startLoop(bool withrestart) {
       status = policy;
     }
     skip = false;
-    if (cv.wait_for(lock, 5s) == std::cv_status::no_timeout) {
-      // cv signaled, exit now if kRunning is false
-      if (!kRunning) break;
+
+    // Sleep until the health HAL reports a change in capacity or charge
+    // status, e.g. a charger being plugged, or until just before the next
+    // limit could be crossed at the estimated rate.
+    const int target = current == ChargeStatus::ON ? upper + 1 : (withrestart ? lower : upper) - 1;
+    const auto interval = predictor.nextWake(per, target, kPollInterval,
+        healthCallbackRegistered ? kPushPollInterval : kMaxPollInterval);
+    ratePerHour = predictor.getRatePerHour();
+    nextPollMs = interval.count();
+    armLoopTimer(interval);
+
+    struct epoll_event events[2];
+    bool timerFired = false, signaled = false;
+    const int n = TEMP_FAILURE_RETRY(epoll_wait(epollFd, events, 2, -1));
+    if (n < 0) {
+      ALOGE("%s: epoll_wait: %s", __func__, strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      uint64_t count;
+      // Resets the timer's expirations and the eventfd counter
+      if (read(events[i].data.fd, &count, sizeof(count)) < 0)
+        continue;
+      if (events[i].data.fd == timerFd.get())
+        timerFired = true;
+      else
+        signaled = true;
+    }
+    // Exit now if kRunning is false
+    if (signaled && !kRunning) break;
+    bool pushed = false;
+    {
+      ScopedLock _(kPushLock);
+      if (pushPending) {
+        state = pushedState;
+        pushPending = false;
+        pushed = true;
+      }
+    }
+    if (pushed) {
+      pushWakeups++;
+    } else if (timerFired) {
+      readBatteryState(&state);
+      pollWakeups++;
     }
   }
+  // A stale alarm would wake the device up for nothing
+  const struct itimerspec disarm {};
+  timerfd_settime(timerFd, 0, &disarm, nullptr);
   ALOGD("%s: --", __func__);
 }
 
 void SmartCharge::createLoopThread(bool restart) {
   ScopedLock _(thread_lock);
   ALOGD("%s: create thread", __func__);
-  kLoopThread = std::make_shared<std::thread>(&SmartCharge::startLoop, this, restart);
+  // Set first, the loop exits when it is false
   kRunning = true;
+  kLoopThread = std::make_shared<std::thread>(&SmartCharge::startLoop, this, restart);
 }
 
 ndk::ScopedAStatus SmartCharge::setChargeLimit(int32_t upper_, int32_t lower_) {
@@ -378,7 +586,8 @@ ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
       ScopedLock _(thread_lock);
       kRunning = false;
       if (kLoopThread->joinable()) {
-        cv.notify_one();
+        // Counted by the eventfd, cannot be missed
+        signalLoop();
         kLoopThread->join();
       }
       kLoopThread.reset();
@@ -390,7 +599,31 @@ ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
   return ndk::ScopedAStatus::ok();
 }
 
-binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* numArgs */) {
+void SmartCharge::benchmarkReaders(int fd, int iterations) {
+  using std::chrono::steady_clock;
+  BatteryState state{};
+
+  auto measure = [&](const char *name, const std::function<bool()> &read) {
+    const auto start = steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      if (!read()) {
+        dprintf(fd, "%s: read failed\n", name);
+        return;
+      }
+    }
+    const auto total = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        steady_clock::now() - start);
+    dprintf(fd, "%s: %d reads, %" PRId64 " ns average\n", name, iterations,
+       static_cast<int64_t>(total.count() / iterations));
+  };
+  measure("sysfs", [&] { return readBatteryStateSysfs(&state); });
+  measure("health HAL", [&] {
+    readBatteryStateHal(&state);
+    return state.capacity >= 0;
+  });
+}
+
+binder_status_t SmartCharge::dump(int fd, const char** args, uint32_t numArgs) {
   Dl_info info;
   void *addr;
   auto tryLockFn = [](std::mutex& m) {
@@ -412,8 +645,8 @@ binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* n
      dprintf(fd, "\n");
   }
   dprintf(fd, "Configuration (upper/lower): %d %d\n", upper, lower);
-  dprintf(fd, "Mutex locked (config/thread/cv) %d %d %d\n", tryLockFn(config_lock),
-     tryLockFn(thread_lock), tryLockFn(kCVLock));
+  dprintf(fd, "Mutex locked (config/thread/push) %d %d %d\n", tryLockFn(config_lock),
+     tryLockFn(thread_lock), tryLockFn(kPushLock));
   dprintf(fd, "Connected Health HAL: ");
   switch (healthState) {
      case USE_HEALTH_AIDL:
@@ -426,10 +659,28 @@ binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* n
          break;
   };
   dprintf(fd, "\n");
+  dprintf(fd, "Health HAL callback registered: %d\n", healthCallbackRegistered.load());
+  dprintf(fd, "Reading battery from sysfs: %d\n", sysfs.isOpen());
+  dprintf(fd, "Loop timer: %s, slack %" PRId64 "ms\n",
+     timerWakesUp ? "CLOCK_BOOTTIME_ALARM" : "CLOCK_BOOTTIME",
+     static_cast<int64_t>(timerSlack.count()));
+  if (kRunning) {
+     dprintf(fd, "Estimated rate: %.1f%%/h, next poll in: %" PRId64 "ms\n", ratePerHour.load(),
+        nextPollMs.load());
+  }
+  dprintf(fd, "Loop wakeups (push/poll): %" PRIu64 " %" PRIu64 "\n", pushWakeups.load(),
+     pollWakeups.load());
   addr = dlsym(handle, MODULE_SYM_NAME);
   if (dladdr(addr, &info) != 0) {
      dprintf(fd, "Impl library path: %s\n", info.dli_fname);
   }
+  // dumpsys ... bench [iterations]
+  if (numArgs > 0 && strcmp(args[0], "bench") == 0) {
+     int iterations = numArgs > 1 ? stoi_safe(args[1]) : 1000;
+     if (iterations <= 0)
+        iterations = 1000;
+     benchmarkReaders(fd, iterations);
+  }
   return STATUS_OK;
 }
 
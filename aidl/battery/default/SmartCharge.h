@@ -8,12 +8,18 @@
 
 #include <aidl/vendor/samsung_ext/framework/battery/BnSmartCharge.h>
 #include <aidl/android/hardware/health/BnHealth.h>
+#include <aidl/android/hardware/health/BnHealthInfoCallback.h>
+#include <android/hardware/health/2.0/IHealthInfoCallback.h>
+#include <android-base/unique_fd.h>
 #include <healthhalutils/HealthHalUtils.h>
 
+#include "BatterySysfs.h"
+#include "WakePredictor.h"
+
 #include <dlfcn.h>
 
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -24,6 +30,7 @@ using android::hardware::hidl_death_recipient;
 using android::sp;
 using android::wp;
 using IHealthAIDL = aidl::android::hardware::health::IHealth;
+using IHealthInfoCallbackHIDL = android::hardware::health::V2_0::IHealthInfoCallback;
 
 namespace aidl {
 namespace vendor {
@@ -41,7 +48,33 @@ class hidl_health_death_recipient : public hidl_death_recipient {
     sp<IHealth> mHealth;
 };
 
+class SmartCharge;
+
+class aidl_health_info_callback
+    : public ::aidl::android::hardware::health::BnHealthInfoCallback {
+  public:
+    aidl_health_info_callback(SmartCharge* sc) : mSmartCharge(sc) {}
+    ndk::ScopedAStatus healthInfoChanged(
+        const ::aidl::android::hardware::health::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mSmartCharge;
+};
+
+class hidl_health_info_callback : public IHealthInfoCallbackHIDL {
+  public:
+    hidl_health_info_callback(SmartCharge* sc) : mSmartCharge(sc) {}
+    ::android::hardware::Return<void> healthInfoChanged(
+        const ::android::hardware::health::V2_0::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mSmartCharge;
+};
+
 class SmartCharge : public BnSmartCharge {
+  friend class aidl_health_info_callback;
+  friend class hidl_health_info_callback;
+
   std::shared_ptr<std::thread> kLoopThread;
   // Protect above thread pointer
   std::mutex thread_lock;
@@ -58,19 +91,28 @@ class SmartCharge : public BnSmartCharge {
   // Thread status indicator
   std::atomic_bool kRunning;
 
-  std::condition_variable cv;
-  // Used by above condition_variable
-  std::mutex kCVLock;
+  // The loop sleeps in epoll on a timer, and an eventfd signaled for
+  // pushed battery changes and for stopping
+  android::base::unique_fd epollFd, eventFd, timerFd;
+  // CLOCK_BOOTTIME_ALARM, waking the device up for the timer
+  bool timerWakesUp = false;
+  std::chrono::milliseconds timerSlack;
+  // Protect pushedState and pushPending
+  std::mutex kPushLock;
 
   void* handle;
   std::function<void(const bool)> setChargableFunc;
 
   sp<IHealth> health_hidl;
   sp<hidl_death_recipient> hidl_death_recp;
+  sp<hidl_health_info_callback> hidl_info_callback;
   std::shared_ptr<IHealthAIDL> health_aidl;
   ndk::ScopedAIBinder_DeathRecipient aidl_death_recp;
+  std::shared_ptr<aidl_health_info_callback> aidl_info_callback;
   // Protect health_hal pointers
   std::mutex hal_health_lock;
+  // Whether the connected HAL pushes battery changes
+  std::atomic_bool healthCallbackRegistered{false};
 
   enum {
       UNKNOWN,
@@ -83,6 +125,47 @@ class SmartCharge : public BnSmartCharge {
       OFF,
   } status;
 
+  struct BatteryState {
+      int capacity;          // Percent, negative on HAL errors
+      ChargeStatus charge;   // Valid if chargeKnown
+      bool chargeKnown;
+
+      bool operator==(const BatteryState& other) const {
+          return capacity == other.capacity && chargeKnown == other.chargeKnown &&
+                 (!chargeKnown || charge == other.charge);
+      }
+  };
+  // Latest state pushed by the health HAL, and whether the loop has not
+  // seen it yet. Protected by kPushLock
+  BatteryState pushedState{-1, ChargeStatus::OFF, false};
+  bool pushPending = false;
+
+  // Loop wakeups, by HAL push and by poll
+  std::atomic_uint64_t pushWakeups{0}, pollWakeups{0};
+  // Charge rate estimated by the loop, and its wait before polling
+  std::atomic<double> ratePerHour{0};
+  std::atomic_int64_t nextPollMs{0};
+
+  // Fast path for battery readings, if enabled and present
+  BatterySysfs sysfs;
+
+  template <typename T>
+  static void setChargeStatus(T halStatus, BatteryState* state);
+  // Read sysfs directly, or query the health HAL
+  void readBatteryState(BatteryState* state);
+  bool readBatteryStateSysfs(BatteryState* state);
+  void readBatteryStateHal(BatteryState* state);
+  // Compare the latency of both paths, for dump()
+  void benchmarkReaders(int fd, int iterations);
+  // Called from the health HAL callbacks
+  void onBatteryStateChanged(const BatteryState& state);
+
+  bool initLoopFds();
+  // Arm the timer to expire after interval, rounded up to the timer slack
+  void armLoopTimer(std::chrono::milliseconds interval);
+  // Wake the loop up
+  void signalLoop();
+
   bool loadAndParseConfigProp();
   void loadImplLibrary();
   void loadEnabledAndStart();
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "WakePredictor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+// Weight of the newest sample
+static constexpr double kAlpha = 0.3;
+// Fraction of the predicted time to the target to wait
+static constexpr double kWakeFraction = 0.5;
+// Assumed until measured, faster than any charger or load: 100% per hour
+static constexpr double kFastestRate = 100.0 / (60 * 60 * 1000);
+
+void WakePredictor::addSample(int capacity, Duration now) {
+  if (!hasLast) {
+    hasLast = true;
+    lastCapacity = capacity;
+    lastChange = now;
+    return;
+  }
+  if (capacity == lastCapacity)
+    return;
+
+  // The first change only marks where a step starts
+  const auto elapsed = (now - lastChange).count();
+  if (anchored && elapsed > 0) {
+    const double sample = static_cast<double>(capacity - lastCapacity) / elapsed;
+    rate = hasRate ? kAlpha * sample + (1 - kAlpha) * rate : sample;
+    hasRate = true;
+  }
+  anchored = true;
+  lastCapacity = capacity;
+  lastChange = now;
+}
+
+void WakePredictor::reset(void) {
+  hasLast = false;
+  anchored = false;
+  hasRate = false;
+  rate = 0;
+}
+
+WakePredictor::Duration WakePredictor::nextWake(int capacity, int target,
+                                                Duration min, Duration max) const {
+  const int distance = target - capacity;
+
+  if (std::abs(distance) <= 1)
+    return min;
+  // Moving away from the target, it is only reached on a status change
+  if (hasRate && (distance > 0) != (rate > 0))
+    return max;
+  const double speed = hasRate ? std::abs(rate) : kFastestRate;
+  const auto predicted = Duration(static_cast<Duration::rep>(
+      kWakeFraction * std::abs(distance) / speed));
+  return std::clamp(predicted, min, max);
+}
+
+double WakePredictor::getRatePerHour(void) const {
+  return hasRate ? rate * std::chrono::duration_cast<Duration>(std::chrono::hours(1)).count() : 0;
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
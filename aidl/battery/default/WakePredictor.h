@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+/**
+ * Estimates how fast the battery charges or discharges, to check it again
+ * just before a limit could be crossed instead of at a fixed interval.
+ *
+ * Capacity moves in 1% steps, so a sample is the slope between two
+ * capacity changes. Samples are averaged with an EWMA. The wait is half the
+ * predicted time to the limit, so checks get closer together as the
+ * capacity nears it.
+ */
+class WakePredictor {
+  public:
+    using Duration = std::chrono::milliseconds;
+
+    /**
+     * Add a capacity reading
+     *
+     * @param capacity capacity in percent
+     * @param now time of the reading, on a clock that includes suspend
+     */
+    void addSample(int capacity, Duration now);
+
+    // Forget the rate, e.g. when the charge status changes direction
+    void reset(void);
+
+    /**
+     * Time to wait before checking again
+     *
+     * @param capacity current capacity in percent
+     * @param target capacity at which the policy changes
+     * @param min shortest wait, used near the target or without a rate
+     * @param max longest wait
+     * @return the wait, between min and max
+     */
+    Duration nextWake(int capacity, int target, Duration min, Duration max) const;
+
+    // Estimated rate in percent per hour, positive while charging
+    double getRatePerHour(void) const;
+
+  private:
+    bool hasLast = false;   // lastCapacity and lastChange are valid
+    bool anchored = false;  // lastChange is the time of a change
+    bool hasRate = false;
+    int lastCapacity = 0;
+    Duration lastChange{}; // When capacity last changed
+    double rate = 0;       // Percent per millisecond
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -1,7 +1,9 @@
 #include <array>
+#include <cstdlib>
 #include <regex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "LoggerInternal.h"
@@ -80,8 +82,7 @@ static inline std::string TrimDoubleQuote(const std::string &str) {
   return str;
 }
 
-// Trim u:object_r, :s0...
-static inline std::string TrimSEContext(const std::string &str) {
+std::string TrimSEContext(const std::string &str) {
   const static std::regex kSEContextRegex(R"(^u:(object_)?r:\w+:s0(.+)?$)");
   if (std::regex_match(str, kSEContextRegex,
                        std::regex_constants::format_sed)) {
@@ -172,6 +173,12 @@ bool parseOneAvcContext(const std::string &str, AvcContexts &outvec) {
     ALOGE("Failed to parse '%s'", sub_str.c_str());
     return false;
   }
+  // e.g. ioctlcmd=0x5401, merged into allowxperm rules
+  auto cmd = attributes.find("ioctlcmd");
+  if (cmd != attributes.end()) {
+    ctx.ioctlcmds.emplace_back(std::strtoul(cmd->second.c_str(), nullptr, 16));
+    attributes.erase(cmd);
+  }
   ctx.misc_attributes = attributes;
   outvec.emplace_back(ctx);
   return true;
@@ -205,3 +212,220 @@ void writeAllowRules(const AvcContexts &ctxs, std::vector<std::string> &out) {
     }
   }
 }
+
+// Permission sets of system/sepolicy's global_macros, largest first
+struct PermMacro {
+  const char *name;
+  std::vector<const char *> perms;
+};
+
+#define R_FILE_PERMS "getattr", "open", "read", "ioctl", "lock", "map", "watch", "watch_reads"
+#define W_FILE_PERMS "open", "append", "write", "lock", "map"
+#define X_FILE_PERMS "getattr", "execute", "execute_no_trans", "map"
+#define R_DIR_PERMS "open", "getattr", "read", "search", "ioctl", "lock", "watch", "watch_reads"
+#define W_DIR_PERMS "open", "search", "write", "add_name", "remove_name", "lock"
+#define RW_SOCKET_PERMS_NO_IOCTL "read", "getattr", "write", "setattr", "lock", "append", \
+  "bind", "connect", "getopt", "setopt", "shutdown", "map"
+
+static const std::vector<PermMacro> kFileMacros = {
+  {"create_file_perms", {"create", "rename", "setattr", "unlink", R_FILE_PERMS, W_FILE_PERMS}},
+  {"rw_file_perms", {R_FILE_PERMS, W_FILE_PERMS}},
+  {"rx_file_perms", {R_FILE_PERMS, X_FILE_PERMS}},
+  {"r_file_perms", {R_FILE_PERMS}},
+  {"w_file_perms", {W_FILE_PERMS}},
+  {"x_file_perms", {X_FILE_PERMS}},
+};
+static const std::vector<PermMacro> kDirMacros = {
+  {"create_dir_perms", {"create", "reparent", "rename", "rmdir", "setattr", R_DIR_PERMS,
+                        W_DIR_PERMS}},
+  {"rw_dir_perms", {R_DIR_PERMS, W_DIR_PERMS}},
+  {"ra_dir_perms", {R_DIR_PERMS, "add_name", "write"}},
+  {"r_dir_perms", {R_DIR_PERMS}},
+};
+static const std::vector<PermMacro> kSocketMacros = {
+  {"create_socket_perms", {"create", "ioctl", RW_SOCKET_PERMS_NO_IOCTL}},
+  {"create_socket_perms_no_ioctl", {"create", RW_SOCKET_PERMS_NO_IOCTL}},
+  {"rw_socket_perms", {"ioctl", RW_SOCKET_PERMS_NO_IOCTL}},
+  {"rw_socket_perms_no_ioctl", {RW_SOCKET_PERMS_NO_IOCTL}},
+};
+
+// A class of the mappings, with its macros as permission bitmasks
+struct ClassPerms {
+  const security_class_mapping *map;
+  std::vector<std::pair<const char *, uint64_t>> macros;
+
+  // Bit of a permission, 0 if the class does not have it
+  uint64_t bitOf(const std::string &perm) const {
+    for (size_t i = 0; i < map->perms.size(); ++i) {
+      if (map->perms[i] == perm)
+        return 1ULL << i;
+    }
+    return 0;
+  }
+};
+
+static const ClassPerms *findClass(const std::string &tclass) {
+  static const auto kClasses = [] {
+    std::unordered_map<std::string, ClassPerms> classes;
+    auto add = [&classes](const security_class_mapping &map) {
+      ClassPerms cls = {&map, {}};
+      const std::vector<PermMacro> *macros = nullptr;
+      if (map.name == "dir")
+        macros = &kDirMacros;
+      else if (map.name.find("socket") != std::string::npos)
+        macros = &kSocketMacros;
+      else if (map.name.find("file") != std::string::npos)
+        macros = &kFileMacros;
+      for (const auto &macro : macros ? *macros : std::vector<PermMacro>()) {
+        uint64_t mask = 0;
+        bool usable = true;
+        for (const char *perm : macro.perms) {
+          const uint64_t bit = cls.bitOf(perm);
+          usable &= bit != 0;
+          mask |= bit;
+        }
+        if (usable)
+          cls.macros.emplace_back(macro.name, mask);
+      }
+      classes.try_emplace(map.name, std::move(cls));
+    };
+    for (const auto &map : secclass_map)
+      add(map);
+    for (const auto &map : secclass_map_ext)
+      add(map);
+    return classes;
+  }();
+  auto it = kClasses.find(tclass);
+  return it != kClasses.end() ? &it->second : nullptr;
+}
+
+/**
+ * Format a permission set, using the class's macros where they are fully
+ * covered, e.g. "{ rw_file_perms create }". Macros never overlap, one is
+ * only used if none of its permissions are covered by another already.
+ *
+ * @param cls the class, nullptr if not in the mappings
+ * @param perms the permissions in the class
+ * @param unknown permissions missing from the mappings, written as they are
+ */
+static std::string formatPerms(const ClassPerms *cls, const uint64_t perms,
+                               const std::vector<std::string> &unknown) {
+  static const decltype(ClassPerms::macros) kNoMacros;
+  std::vector<std::string> tokens;
+  uint64_t left = perms;
+
+  for (const auto &[name, mask] : cls ? cls->macros : kNoMacros) {
+    if ((left & mask) == mask) {
+      tokens.emplace_back(name);
+      left &= ~mask;
+    }
+  }
+  for (size_t i = 0; left != 0; ++i, left >>= 1) {
+    if (left & 1)
+      tokens.emplace_back(cls->map->perms[i]);
+  }
+  tokens.insert(tokens.end(), unknown.begin(), unknown.end());
+  if (tokens.size() == 1)
+    return tokens.front();
+  std::string ret = "{";
+  for (const auto &t : tokens)
+    ret += ' ' + t;
+  return ret + " }";
+}
+
+// Format sorted ioctl commands as ranges, e.g. "{ 0x5401-0x5403 0x5413 }"
+static std::string formatIoctls(const std::vector<uint16_t> &cmds) {
+  std::string ret;
+  char buf[16];
+  size_t nr_tokens = 0;
+
+  for (size_t i = 0; i < cmds.size(); ++i) {
+    size_t j = i;
+    while (j + 1 < cmds.size() && cmds[j + 1] == cmds[j] + 1)
+      ++j;
+    if (j > i)
+      snprintf(buf, sizeof(buf), " 0x%x-0x%x", cmds[i], cmds[j]);
+    else
+      snprintf(buf, sizeof(buf), " 0x%x", cmds[i]);
+    ret += buf;
+    nr_tokens++;
+    i = j;
+  }
+  if (nr_tokens == 1)
+    return ret.substr(1);
+  return '{' + ret + " }";
+}
+
+void writeDomainPolicies(const AvcContexts &ctxs,
+                         std::map<std::string, std::vector<std::string>> &out) {
+  // Permissions and ioctls of each (source, target, class)
+  struct Access {
+    std::string source, target, tclass;
+    const ClassPerms *cls;  // nullptr if not in the mappings
+    uint64_t perms;
+    std::vector<std::string> unknown;  // Permissions missing from the mappings
+    std::vector<uint16_t> ioctls;
+  };
+  // Targets sharing a rule body, e.g. "allow source { targets }:class perms;"
+  struct Rule {
+    std::string source, prefix, body;
+    std::vector<std::string> targets;
+  };
+  std::vector<Access> accesses;
+  std::unordered_map<std::string, size_t> accessIndex;
+  std::vector<Rule> rules;
+  std::unordered_map<std::string, size_t> ruleIndex;
+
+  for (const auto &ctx : ctxs) {
+    if (ctx.stale || ctx.operation.empty())
+      continue;
+    const auto *cls = findClass(ctx.tclass);
+    auto source = TrimSEContext(ctx.scontext);
+    auto target = TrimSEContext(ctx.tcontext);
+    auto [it, inserted] = accessIndex.try_emplace(source + ' ' + target + ':' + ctx.tclass,
+                                                  accesses.size());
+    if (inserted)
+      accesses.push_back({std::move(source), std::move(target), ctx.tclass, cls, 0, {}, {}});
+    auto &access = accesses[it->second];
+    for (const auto &op : ctx.operation) {
+      const uint64_t bit = cls ? cls->bitOf(op) : 0;
+      if (bit != 0)
+        access.perms |= bit;
+      else
+        access.unknown.emplace_back(op);
+    }
+    access.ioctls.insert(access.ioctls.end(), ctx.ioctlcmds.begin(), ctx.ioctlcmds.end());
+  }
+
+  auto addRule = [&](const Access &access, const char *prefix, std::string body) {
+    auto [it, inserted] = ruleIndex.try_emplace(
+        access.source + ' ' + prefix + ' ' + access.tclass + ' ' + body, rules.size());
+    if (inserted)
+      rules.push_back({access.source, prefix, ':' + access.tclass + ' ' + body, {}});
+    rules[it->second].targets.emplace_back(access.target);
+  };
+  for (auto &access : accesses) {
+    eraseDuplicates(access.unknown);
+    if (access.perms != 0 || !access.unknown.empty())
+      addRule(access, "allow", formatPerms(access.cls, access.perms, access.unknown));
+  }
+  for (auto &access : accesses) {
+    if (access.ioctls.empty())
+      continue;
+    eraseDuplicates(access.ioctls);
+    addRule(access, "allowxperm", "ioctl " + formatIoctls(access.ioctls));
+  }
+
+  for (const auto &rule : rules) {
+    std::string line = rule.prefix + ' ' + rule.source + ' ';
+    if (rule.targets.size() == 1) {
+      line += rule.targets.front();
+    } else {
+      line += '{';
+      for (const auto &t : rule.targets)
+        line += ' ' + t;
+      line += " }";
+    }
+    out[rule.source].emplace_back(line + rule.body + ';');
+  }
+}
@@ -0,0 +1,118 @@
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+#include "AvcBaseline.h"
+
+static uint64_t hashTuple(const AvcContext &ctx, const std::string &scontext,
+                          const std::string &tcontext, const std::string &perm) {
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+  auto mix = [&hash](const std::string &str) {
+    for (const unsigned char c : str) {
+      hash ^= c;
+      hash *= 0x100000001b3ULL;
+    }
+    hash ^= ' ';
+    hash *= 0x100000001b3ULL;
+  };
+  mix(ctx.granted ? "granted" : "denied");
+  mix(scontext);
+  mix(tcontext);
+  mix(ctx.tclass);
+  mix(perm);
+  return hash;
+}
+
+bool AvcBaseline::load(const std::string &file) {
+  BaselineHeader header{};
+  path = file;
+
+  const auto dir = std::filesystem::path(path).parent_path();
+  lock_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0) {
+    PLOGE("Failed to lock '%s'", dir.c_str());
+    return false;
+  }
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return true;
+  if (read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == kBaselineMagic &&
+      header.version == kBaselineVersion) {
+    struct stat statbuf {};
+    if (fstat(fd, &statbuf) == 0 &&
+        sizeof(header) + header.count * sizeof(uint64_t) == static_cast<uint64_t>(statbuf.st_size)) {
+      hashes.resize(header.count);
+      const ssize_t want = header.count * sizeof(uint64_t);
+      if (read(fd, hashes.data(), want) != want || !std::is_sorted(hashes.begin(), hashes.end()))
+        hashes.clear();
+    }
+  }
+  if (hashes.size() != header.count)
+    ALOGW("Ignoring invalid AVC baseline '%s'", path.c_str());
+  close(fd);
+  return true;
+}
+
+AvcContexts AvcBaseline::update(const AvcContexts &ctxs) {
+  std::vector<uint64_t> added;
+  AvcContexts fresh;
+
+  for (const auto &ctx : ctxs) {
+    if (ctx.stale)
+      continue;
+    // Compare types only, categories differ between boots
+    const auto scontext = TrimSEContext(ctx.scontext);
+    const auto tcontext = TrimSEContext(ctx.tcontext);
+    AvcContext copy = ctx;
+    copy.operation.clear();
+    for (const auto &perm : ctx.operation) {
+      const uint64_t hash = hashTuple(ctx, scontext, tcontext, perm);
+      if (!std::binary_search(hashes.begin(), hashes.end(), hash)) {
+        copy.operation.emplace_back(perm);
+        added.emplace_back(hash);
+      }
+    }
+    if (!copy.operation.empty())
+      fresh.emplace_back(std::move(copy));
+  }
+
+  eraseDuplicates(added);
+  const size_t old = hashes.size();
+  hashes.insert(hashes.end(), added.begin(), added.end());
+  std::inplace_merge(hashes.begin(), hashes.begin() + old, hashes.end());
+  return fresh;
+}
+
+bool AvcBaseline::save(void) {
+  const BaselineHeader header = {kBaselineMagic, kBaselineVersion, hashes.size()};
+  const std::string tmp = path + ".tmp";
+  bool ret = true;
+
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", tmp.c_str());
+    return false;
+  }
+  const ssize_t size = hashes.size() * sizeof(uint64_t);
+  ret &= write(fd, &header, sizeof(header)) == sizeof(header);
+  ret &= write(fd, hashes.data(), size) == size;
+  ret &= fsync(fd) == 0;
+  close(fd);
+  if (!ret || rename(tmp.c_str(), path.c_str()) < 0) {
+    PLOGE("Failed to write '%s'", path.c_str());
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+AvcBaseline::~AvcBaseline() {
+  if (lock_fd >= 0)
+    close(lock_fd);
+}
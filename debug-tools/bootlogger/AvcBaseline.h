@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+/**
+ * Set of (scontext, tcontext, tclass, permission) tuples seen in previous
+ * boots, persisted as sorted 64-bit hashes.
+ *
+ * The file is a BaselineHeader followed by count uint64_t hashes, in
+ * ascending order. It is replaced atomically, under a lock of its
+ * directory, as the boot and system loggers may both update it.
+ */
+static constexpr uint32_t kBaselineMagic = 0x42435641;  // "AVCB"
+static constexpr uint32_t kBaselineVersion = 1;
+
+struct BaselineHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+};
+
+struct AvcBaseline {
+  /**
+   * Lock and load the baseline, a missing or invalid file is an empty one
+   *
+   * @param path path of the baseline file
+   * @return false if the directory could not be locked
+   */
+  bool load(const std::string &path);
+
+  /**
+   * Add the tuples of ctxs to the baseline
+   *
+   * @param ctxs contexts to add
+   * @return copies of ctxs, reduced to the permissions not seen before.
+   *         Contexts without any are left out.
+   */
+  AvcContexts update(const AvcContexts &ctxs);
+
+  // Write the baseline back
+  bool save(void);
+
+  size_t size() const { return hashes.size(); }
+
+  ~AvcBaseline();
+
+ private:
+  std::string path;
+  int lock_fd = -1;
+  std::vector<uint64_t> hashes;
+};
@@ -0,0 +1,245 @@
+#include "AvcWorker.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+#include "ResourceGovernor.h"
+
+// How long the worker sleeps when the queue is empty, without an eventfd
+static constexpr int kIdleSleepMs = 20;
+
+LineQueue::LineQueue(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  slots = std::make_unique<Slot[]>(size);
+  for (size_t i = 0; i < size; ++i)
+    slots[i].seq.store(i, std::memory_order_relaxed);
+  mask = size - 1;
+}
+
+bool LineQueue::push(const std::string &line, uint64_t stamp) {
+  size_t pos = head.load(std::memory_order_relaxed);
+  Slot *slot;
+
+  for (;;) {
+    slot = &slots[pos & mask];
+    const size_t seq = slot->seq.load(std::memory_order_acquire);
+    const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      // The consumer has not freed this slot of the previous lap
+      return false;
+    } else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+  slot->data.assign(line);
+  slot->stamp = stamp;
+  slot->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool LineQueue::pop(std::string &line, uint64_t &stamp) {
+  Slot *slot = &slots[tail & mask];
+
+  if (slot->seq.load(std::memory_order_acquire) != tail + 1)
+    return false;
+  // Swap, so the slot keeps a buffer for the next lap
+  line.swap(slot->data);
+  stamp = slot->stamp;
+  slot->seq.store(tail + mask + 1, std::memory_order_release);
+  tail++;
+  return true;
+}
+
+bool LineQueue::empty(void) const {
+  return slots[tail & mask].seq.load(std::memory_order_acquire) != tail + 1;
+}
+
+AvcWorker::AvcWorker(std::shared_ptr<AvcContexts> ctxs, uint64_t bucket_ms, size_t nr_buckets)
+    : ctxs(std::move(ctxs)),
+      bucket_ms(std::max<uint64_t>(bucket_ms, 1)),
+      buckets(std::max<size_t>(nr_buckets, 1)) {}
+
+// Milliseconds since boot, like the kmsg timestamps
+static uint64_t nowMs(void) {
+  struct timespec ts {};
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void AvcWorker::submit(const std::string &line) {
+  if (!queue.push(line, nowMs()))
+    nr_dropped++;
+  // Pairs with the fence in run(), either the worker sees the line or
+  // this sees it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+    wake();
+}
+
+void AvcWorker::wake(void) {
+  const uint64_t one = 1;
+
+  if (wake_fd >= 0)
+    write(wake_fd, &one, sizeof(one));
+}
+
+AvcWorker::Bucket &AvcWorker::bucketAt(uint64_t stamp) {
+  const uint64_t id = stamp / bucket_ms;
+  auto &bucket = buckets[id % buckets.size()];
+  if (bucket.id != id) {
+    bucket.id = id;
+    bucket.dropped = 0;
+    bucket.counts.clear();
+  }
+  return bucket;
+}
+
+void AvcWorker::start(void) {
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0)
+    PLOGE("eventfd, polling the AVC queue");
+  running = true;
+  thread = std::thread([this] { run(); });
+}
+
+void AvcWorker::stop(void) {
+  running = false;
+  wake();
+  if (thread.joinable())
+    thread.join();
+  if (wake_fd >= 0)
+    close(wake_fd);
+  wake_fd = -1;
+}
+
+void AvcWorker::parse(const std::string &line, uint64_t stamp) {
+  const size_t before = ctxs->size();
+
+  if (!parseOneAvcContext(line, *ctxs))
+    return;
+  nr_parsed++;
+  auto &ctx = ctxs->back();
+
+  auto [dom, added] = domains.try_emplace(ctx.scontext, domain_names.size());
+  if (added) {
+    // Contexts only differing in categories share the column
+    auto name = TrimSEContext(ctx.scontext);
+    auto it = std::find(domain_names.begin(), domain_names.end(), name);
+    dom->second = it - domain_names.begin();
+    if (it == domain_names.end())
+      domain_names.emplace_back(std::move(name));
+  }
+  auto &bucket = bucketAt(stamp);
+  if (bucket.counts.size() <= dom->second)
+    bucket.counts.resize(dom->second + 1);
+  bucket.counts[dom->second]++;
+
+  auto key = std::to_string(ctx.granted) + ' ' + ctx.scontext + ' ' + ctx.tcontext + ' ' +
+             ctx.tclass;
+  auto [it, inserted] = index.try_emplace(std::move(key), before);
+  if (!inserted) {
+    (*ctxs)[it->second] += ctx;
+    ctxs->pop_back();
+  }
+}
+
+void AvcWorker::run(void) {
+  std::string line;
+  uint64_t stamp;
+
+  ResourceGovernor::get().applyThread(ResourceGovernor::BACKGROUND);
+  for (;;) {
+    // Read running first, so everything queued before stop() is drained
+    const bool last = !running;
+    {
+      const std::lock_guard<std::mutex> _(ctxs_lock);
+      while (queue.pop(line, stamp))
+        parse(line, stamp);
+    }
+    // Drops are only known in total, put them in the current bucket
+    const uint64_t dropped = nr_dropped;
+    const bool dropping = dropped != dropped_seen;
+    if (dropping) {
+      bucketAt(nowMs()).dropped += dropped - dropped_seen;
+      dropped_seen = dropped;
+    }
+    if (last)
+      break;
+
+    sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!queue.empty() || !running) {
+      sleeping = false;
+      continue;
+    }
+    // Lines carry their own stamps, only drops need waking up once per
+    // bucket to land in the right one, and only while they happen
+    struct pollfd pfd = {wake_fd, POLLIN, 0};
+    int timeout = dropping ? static_cast<int>(std::min<uint64_t>(bucket_ms, INT32_MAX)) : -1;
+    if (wake_fd < 0)
+      timeout = kIdleSleepMs;
+    if (poll(&pfd, 1, timeout) > 0) {
+      uint64_t count;
+      read(wake_fd, &count, sizeof(count));
+    }
+    sleeping = false;
+  }
+}
+
+AvcContexts AvcWorker::snapshot(void) {
+  const std::lock_guard<std::mutex> _(ctxs_lock);
+  return *ctxs;
+}
+
+AvcWorker::~AvcWorker() {
+  stop();
+}
+
+std::string AvcWorker::getRateCsv(void) const {
+  std::string csv = "time_s";
+  uint64_t first = UINT64_MAX, last = 0;
+  char buf[32];
+
+  for (const auto &name : domain_names)
+    csv += ',' + name;
+  csv += ",dropped\n";
+
+  for (const auto &bucket : buckets) {
+    if (bucket.id != UINT64_MAX)
+      last = std::max(last, bucket.id);
+  }
+  // Buckets left over from before the ring lapped are stale
+  for (const auto &bucket : buckets) {
+    if (bucket.id != UINT64_MAX && bucket.id + buckets.size() > last)
+      first = std::min(first, bucket.id);
+  }
+  if (first == UINT64_MAX)
+    return csv;
+
+  // Every bucket in the window, so the series has no holes
+  for (uint64_t id = first; id <= last; ++id) {
+    const auto &bucket = buckets[id % buckets.size()];
+    const bool valid = bucket.id == id;
+    snprintf(buf, sizeof(buf), "%" PRIu64 ".%03" PRIu64, id * bucket_ms / 1000,
+             id * bucket_ms % 1000);
+    csv += buf;
+    for (size_t i = 0; i < domain_names.size(); ++i) {
+      csv += ',';
+      csv += std::to_string(valid && i < bucket.counts.size() ? bucket.counts[i] : 0);
+    }
+    csv += ',' + std::to_string(valid ? bucket.dropped : 0) + '\n';
+  }
+  return csv;
+}
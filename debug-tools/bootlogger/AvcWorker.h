@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+/**
+ * Bounded lock-free queue of lines, many producers and one consumer.
+ *
+ * Each slot carries a sequence number telling whether it is free for the
+ * producer claiming position pos (seq == pos) or filled for the consumer
+ * (seq == pos + 1). Slot strings keep their capacity, so steady state
+ * pushing and popping does not allocate.
+ */
+struct LineQueue {
+  // Capacity is rounded up to a power of two
+  explicit LineQueue(size_t capacity);
+
+  /**
+   * Copy a line into the queue
+   *
+   * @param line the line
+   * @param stamp timestamp of the line, in milliseconds
+   * @return false if the queue is full
+   */
+  bool push(const std::string &line, uint64_t stamp);
+
+  /**
+   * Take the oldest line, consumer only
+   *
+   * @return false if the queue is empty
+   */
+  bool pop(std::string &line, uint64_t &stamp);
+
+  // Whether there is nothing to pop, consumer only
+  bool empty(void) const;
+
+ private:
+  struct Slot {
+    std::atomic_size_t seq;
+    uint64_t stamp;
+    std::string data;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  alignas(64) std::atomic_size_t head = 0;  // Next position to claim
+  alignas(64) size_t tail = 0;              // Next position to consume
+};
+
+/**
+ * Parses and aggregates AVC denials off the capture threads.
+ *
+ * The capture threads only match and queue the lines, a worker thread
+ * parses them and merges each into the AvcContext with the same
+ * scontext/tcontext/tclass, so the contexts come out aggregated.
+ *
+ * It also counts the denials per source domain in buckets of time since
+ * boot. The buckets form a ring, only the newest ones are kept.
+ *
+ * The worker sleeps on an eventfd, which producers only signal when it
+ * went to sleep on an empty queue.
+ */
+struct AvcWorker {
+  /**
+   * @param ctxs contexts to aggregate to, only accessed by the worker
+   *        until stop() returns
+   * @param bucket_ms width of the rate buckets
+   * @param nr_buckets number of rate buckets kept
+   */
+  AvcWorker(std::shared_ptr<AvcContexts> ctxs, uint64_t bucket_ms, size_t nr_buckets);
+
+  // Queue a matched line, callable from any thread
+  void submit(const std::string &line);
+
+  void start(void);
+
+  // Parse what is still queued and stop the worker
+  void stop(void);
+
+  // Copy of the contexts aggregated so far, callable from any thread
+  AvcContexts snapshot(void);
+
+  uint64_t getParsed() const { return nr_parsed; }
+  uint64_t getDropped() const { return nr_dropped; }
+
+  /**
+   * Get the rates as CSV, only valid after stop().
+   * One row per bucket, with its start in seconds since boot, the count of
+   * each source domain, and the lines dropped because the queue was full.
+   */
+  std::string getRateCsv(void) const;
+
+  ~AvcWorker();
+
+ private:
+  static constexpr size_t kQueueSize = 1024;
+
+  struct Bucket {
+    uint64_t id = UINT64_MAX;  // Start time / bucket_ms
+    uint64_t dropped = 0;
+    std::vector<uint32_t> counts;  // Indexed by domain
+  };
+
+  void run(void);
+  // Wake the worker
+  void wake(void);
+  void parse(const std::string &line, uint64_t stamp);
+  // The bucket of a timestamp, reset if it held an older one
+  Bucket &bucketAt(uint64_t stamp);
+
+  std::shared_ptr<AvcContexts> ctxs;
+  // Only taken by the worker and snapshot(), never by the capture threads
+  std::mutex ctxs_lock;
+  LineQueue queue{kQueueSize};
+  // Index into ctxs of each granted/scontext/tcontext/tclass
+  std::unordered_map<std::string, size_t> index;
+  // Rates
+  uint64_t bucket_ms;
+  std::vector<Bucket> buckets;
+  std::unordered_map<std::string, size_t> domains;  // scontext to domain
+  std::vector<std::string> domain_names;
+  uint64_t dropped_seen = 0;
+  std::thread thread;
+  std::atomic_bool running = false;
+  // Worker wakeup, and whether the worker is about to wait on it
+  int wake_fd = -1;
+  std::atomic_bool sleeping = false;
+  std::atomic_uint64_t nr_parsed = 0;
+  std::atomic_uint64_t nr_dropped = 0;
+};
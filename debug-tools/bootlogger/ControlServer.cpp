@@ -0,0 +1,145 @@
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <cutils/sockets.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "ControlServer.h"
+#include "LoggerInternal.h"
+
+using android::base::Tokenize;
+using android::base::Trim;
+using android::base::WaitForProperty;
+
+// Longest wait without wake_fd, as then nothing else ends it
+static constexpr std::chrono::milliseconds kMaxWaitNoWake(500);
+
+void ControlServer::add(const std::string &name, const std::string &help, Handler handler) {
+  commands.emplace(name, Command{help, std::move(handler)});
+}
+
+bool ControlServer::start(void) {
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0)
+    PLOGE("eventfd");
+  sockfd = android_get_control_socket(kControlSocketName);
+  if (sockfd < 0) {
+    ALOGW("No '%s' socket from init, control commands are not served", kControlSocketName);
+    return false;
+  }
+  if (listen(sockfd, 4) < 0) {
+    PLOGE("listen");
+    sockfd = -1;
+    return false;
+  }
+  return true;
+}
+
+void ControlServer::wakeOnProperty(const std::string &name, const std::string &value) {
+  if (wake_fd < 0)
+    return;
+  // Its own reference to the eventfd, the thread may outlive the server
+  const int fd = fcntl(wake_fd, F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    PLOGE("dup");
+    return;
+  }
+  std::thread([name, value, fd] {
+    const uint64_t one = 1;
+
+    WaitForProperty(name, value);
+    write(fd, &one, sizeof(one));
+    close(fd);
+  }).detach();
+}
+
+void ControlServer::poll(std::chrono::milliseconds timeout) {
+  struct pollfd pfds[] = {{sockfd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+
+  if (wake_fd < 0)
+    timeout = std::min(timeout, kMaxWaitNoWake);
+  if (sockfd < 0 && wake_fd < 0) {
+    std::this_thread::sleep_for(timeout);
+    return;
+  }
+  const int ms = timeout == std::chrono::milliseconds::max() ? -1 : timeout.count();
+  if (::poll(pfds, 2, ms) <= 0)
+    return;
+  if (pfds[1].revents & POLLIN) {
+    uint64_t count;
+    read(wake_fd, &count, sizeof(count));
+  }
+  if (!(pfds[0].revents & POLLIN))
+    return;
+  int client = accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (client < 0) {
+    PLOGE("accept4");
+    return;
+  }
+  serve(client);
+  close(client);
+}
+
+void ControlServer::serve(int client) {
+  struct timeval tv = {1, 0};
+  char buf[256] = {0};
+  std::string response;
+
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  ssize_t len = recv(client, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return;
+  // Tokenize, so repeated spaces don't make empty arguments
+  auto args = Tokenize(Trim(std::string(buf, strnlen(buf, len))), " \t");
+  if (args.empty())
+    return;
+  const auto name = args.front();
+  args.erase(args.begin());
+
+  auto it = commands.find(name);
+  if (name == "help") {
+    for (const auto &[cmd, entry] : commands)
+      response += cmd + ": " + entry.help + '\n';
+  } else if (it != commands.end()) {
+    ALOGI("%s: Control command '%s'", __func__, name.c_str());
+    response = it->second.handler(args);
+  } else {
+    response = "Unknown command '" + name + "', try help\n";
+  }
+  send(client, response.data(), response.size(), MSG_NOSIGNAL);
+}
+
+ControlServer::~ControlServer() {
+  if (sockfd >= 0)
+    close(sockfd);
+  if (wake_fd >= 0)
+    close(wake_fd);
+}
+
+int SendControlCommand(const std::string &command, std::string &response) {
+  char buf[BUFSIZ];
+  ssize_t len;
+
+  int sock = socket_local_client(kControlSocketName, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_STREAM);
+  if (sock < 0)
+    return -errno;
+  const std::string req = command + '\n';
+  if (send(sock, req.c_str(), req.size(), MSG_NOSIGNAL) < 0) {
+    int err = -errno;
+    close(sock);
+    return err;
+  }
+  while ((len = recv(sock, buf, sizeof(buf), 0)) > 0)
+    response.append(buf, len);
+  int err = len < 0 ? -errno : 0;
+  close(sock);
+  return err;
+}
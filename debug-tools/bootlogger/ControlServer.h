@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// Name of the init-created socket taking control commands
+static constexpr char kControlSocketName[] = "logger_ctl";
+
+/**
+ * Serves commands over the init-created unix socket, from the caller's
+ * event loop. A client sends one line "command [args...]" and reads the
+ * response until the logger closes the connection.
+ */
+struct ControlServer {
+  // Returns the response, new line terminated
+  using Handler = std::function<std::string(const std::vector<std::string> &args)>;
+
+  /**
+   * Register a command, must be done before start()
+   *
+   * @param name the command
+   * @param help one line description, listed by "help"
+   * @param handler invoked with the arguments after the command
+   */
+  void add(const std::string &name, const std::string &help, Handler handler);
+
+  // Start listening, false if the socket is not available
+  bool start(void);
+
+  /**
+   * Make poll() return once a property has a value. Waited for by a
+   * detached thread, so the event loop does not have to poll the property.
+   *
+   * @param name the property
+   * @param value the value to wait for
+   */
+  void wakeOnProperty(const std::string &name, const std::string &value);
+
+  /**
+   * Wait for a client and serve it
+   *
+   * @param timeout longest time to wait, by default until a client or
+   *        wakeOnProperty()
+   */
+  void poll(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+  ~ControlServer();
+
+ private:
+  struct Command {
+    std::string help;
+    Handler handler;
+  };
+
+  void serve(int client);
+
+  int sockfd = -1;
+  // Written to by wakeOnProperty()
+  int wake_fd = -1;
+  std::map<std::string, Command> commands;
+};
+
+/**
+ * Send a command to the logger
+ *
+ * @param command command line, e.g. "rotate"
+ * @param response buffer for the response
+ * @return 0 on success, or negative errno
+ */
+int SendControlCommand(const std::string &command, std::string &response);
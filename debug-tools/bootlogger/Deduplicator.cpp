@@ -0,0 +1,43 @@
+#include "Deduplicator.h"
+#include "LogLine.h"
+
+// FNV-1a, good enough to rule out most non-repeats before comparing
+static uint64_t hashOf(std::string_view str) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const unsigned char c : str) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void Deduplicator::flush(const Writer &write) {
+  if (repeats == 0)
+    return;
+  write(repeat_prefix + "last message repeated " + std::to_string(repeats) +
+        (repeats == 1 ? " time" : " times"));
+  repeats = 0;
+}
+
+void Deduplicator::record(const std::string &line, const Writer &write) {
+  const auto body = StripTimestamp(line);
+  const uint64_t hash = hashOf(body);
+  const size_t prefix = line.size() - body.size();
+
+  if (hash == last_hash && std::string_view(last).substr(last_prefix) == body) {
+    const auto now = std::chrono::steady_clock::now();
+    if (repeats == 0)
+      since = now;
+    repeats++;
+    repeat_prefix.assign(line, 0, prefix);
+    // Don't hide an endless storm
+    if (now - since >= kMaxHold)
+      flush(write);
+    return;
+  }
+  flush(write);
+  write(line);
+  last = line;
+  last_prefix = prefix;
+  last_hash = hash;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * Collapses consecutive identical records (ignoring the timestamp) into
+ * a single "last message repeated N times" record.
+ */
+struct Deduplicator {
+  using Writer = std::function<void(const std::string &line)>;
+
+  /**
+   * Feed a record to the deduplicator
+   *
+   * @param line the record
+   * @param write invoked for each record to be written out
+   */
+  void record(const std::string &line, const Writer &write);
+
+  // Write out the pending repeat count, if any
+  void flush(const Writer &write);
+
+ private:
+  // Longest time a storm is kept collapsed before reporting it
+  static constexpr auto kMaxHold = std::chrono::seconds(5);
+
+  std::string last;        // Last written record
+  size_t last_prefix = 0;  // Length of its timestamp
+  uint64_t last_hash = 0;
+  std::string repeat_prefix;  // Timestamp of the newest repeat
+  uint64_t repeats = 0;
+  std::chrono::steady_clock::time_point since{};
+};
@@ -0,0 +1,146 @@
+#include <android-base/file.h>
+#include <android-base/strings.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <system_error>
+
+#include "Demuxer.h"
+#include "LogLine.h"
+#include "LoggerInternal.h"
+
+using android::base::ReadFileToString;
+using android::base::Trim;
+
+namespace fs = std::filesystem;
+
+// Forget process names beyond this, pids get reused anyway
+static constexpr size_t kMaxComms = 4096;
+// Forget file names beyond this, only the file and reopen counts suffer
+static constexpr size_t kMaxKnown = 4096;
+
+Demuxer::Demuxer(const fs::path &dir, Key key, const std::vector<std::string> &only,
+                 size_t max_open)
+    : dir(dir), key(key), only(only), max_open(std::max<size_t>(max_open, 1)) {}
+
+// Keys come from the logs, keep them from escaping the directory
+static std::string sanitize(std::string_view name) {
+  std::string out(name.substr(0, 64));
+  for (auto &c : out) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-' && c != '_')
+      c = '_';
+  }
+  if (out.empty() || out.front() == '.')
+    out.insert(out.begin(), '_');
+  return out;
+}
+
+std::string Demuxer::fileName(std::string_view line) {
+  // kmsg lines only have a priority, neither a tag nor a pid
+  if (line.empty() || line.front() == '<')
+    return {};
+  if (key == TAG) {
+    auto tag = RateLimitKey(line);
+    if (tag.empty())
+      return {};
+    if (!only.empty() && std::find(only.begin(), only.end(), tag) == only.end())
+      return {};
+    return sanitize(tag);
+  }
+
+  auto body = StripTimestamp(line);
+  int pid = 0;
+  if (body.size() == line.size() ||
+      std::from_chars(body.data(), body.data() + body.size(), pid).ec != std::errc() || pid <= 0)
+    return {};
+  auto it = comms.find(pid);
+  if (it == comms.end()) {
+    std::string comm;
+    if (comms.size() >= kMaxComms)
+      comms.clear();
+    // The process may be gone already, then only the pid is known
+    ReadFileToString("/proc/" + std::to_string(pid) + "/comm", &comm);
+    it = comms.emplace(pid, Trim(comm)).first;
+  }
+  if (!only.empty() && std::find(only.begin(), only.end(), it->second) == only.end() &&
+      std::find(only.begin(), only.end(), std::to_string(pid)) == only.end())
+    return {};
+  return it->second.empty() ? std::to_string(pid)
+                            : std::to_string(pid) + '-' + sanitize(it->second);
+}
+
+OutputBackend *Demuxer::get(const std::string &name) {
+  auto it = open_files.find(name);
+  if (it != open_files.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second.get();
+  }
+
+  auto known_it = known.find(name);
+  if (known_it != known.end() && !known_it->second)
+    return nullptr;
+
+  if (!dir_created) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+      ALOGE("Failed to create directory '%s': %s", dir.c_str(), ec.message().c_str());
+    dir_created = true;
+  }
+  if (lru.size() >= max_open) {
+    open_files.erase(lru.back().first);
+    lru.pop_back();
+  }
+  const bool is_new = known_it == known.end();
+  if (is_new && known.size() >= kMaxKnown)
+    known.clear();
+  auto backend = OutputBackend::makeDefault(false);
+  // Remember failures, not to retry the open on every record of the key
+  const bool opened = backend->open((dir / (name + backend->extension())).string());
+  if (is_new)
+    known.emplace(name, opened);
+  if (!opened)
+    return nullptr;
+  if (is_new)
+    nr_files++;
+  else
+    nr_reopens++;
+  lru.emplace_front(name, std::move(backend));
+  open_files.emplace(name, lru.begin());
+  return lru.front().second.get();
+}
+
+void Demuxer::record(const std::string &line) {
+  const auto name = fileName(line);
+  if (name.empty())
+    return;
+  auto backend = get(name);
+  if (backend != nullptr)
+    backend->write(line.c_str(), line.size());
+}
+
+void Demuxer::flush() {
+  for (auto &entry : lru)
+    entry.second->flush();
+}
+
+std::string Demuxer::rotate() {
+  if (!dir_created)
+    return {};
+  // Closes all files, the next records recreate the directory
+  open_files.clear();
+  lru.clear();
+  known.clear();
+  dir_created = false;
+  const auto rotated = dir.string() + '.' + std::to_string(++rotations);
+  std::error_code ec;
+  fs::rename(dir, rotated, ec);
+  if (ec) {
+    ALOGE("Failed to rename '%s' to '%s': %s", dir.c_str(), rotated.c_str(),
+          ec.message().c_str());
+    rotations--;
+    return {};
+  }
+  return rotated;
+}
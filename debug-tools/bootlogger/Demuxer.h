@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "OutputContext.h"
+
+/**
+ * Routes a copy of each record to a file per tag or per process.
+ *
+ * Only the most recently used files are kept open. Evicted files are
+ * closed, and reopened for appending when their key shows up again.
+ * Every file uses the default OutputBackend, without io_uring, so it
+ * follows the same durability policy as the main output. Files that
+ * failed to open are not retried.
+ * Not thread safe, each LoggerContext owns one.
+ */
+struct Demuxer {
+  enum Key {
+    TAG,  // The logcat tag
+    PID,  // The logcat pid, and its process name
+  };
+
+  /**
+   * @param dir directory to place the files in, created on demand
+   * @param key what to split records by
+   * @param only if not empty, only these keys get a file
+   * @param max_open most files to keep open at once
+   */
+  Demuxer(const std::filesystem::path &dir, Key key, const std::vector<std::string> &only,
+          size_t max_open);
+
+  // Write a copy of the record to its key's file, if it has one
+  void record(const std::string &line);
+
+  // Flush the open files
+  void flush();
+
+  /**
+   * Move the directory aside as <dir>.<N> and start over in a new one
+   *
+   * @return the rotated path, or empty if nothing was written or it failed
+   */
+  std::string rotate();
+
+  // Files created and reopened so far
+  uint64_t getFiles() const { return nr_files; }
+  uint64_t getReopens() const { return nr_reopens; }
+
+ private:
+  using Entry = std::pair<std::string, std::unique_ptr<OutputBackend>>;
+
+  // File name of the record's key, empty if it has none
+  std::string fileName(std::string_view line);
+  // Find or open the backend of a file name, keeping it most recently used
+  OutputBackend *get(const std::string &name);
+
+  std::filesystem::path dir;
+  Key key;
+  std::vector<std::string> only;
+  size_t max_open;
+  bool dir_created = false;
+  unsigned rotations = 0;
+  // Most recently used first
+  std::list<Entry> lru;
+  std::unordered_map<std::string, std::list<Entry>::iterator> open_files;
+  // Names of the files seen so far, to tell reopens apart, and whether
+  // they could be opened
+  std::unordered_map<std::string, bool> known;
+  // Process names of pids seen
+  std::unordered_map<int, std::string> comms;
+  std::atomic_uint64_t nr_files = 0;
+  std::atomic_uint64_t nr_reopens = 0;
+};
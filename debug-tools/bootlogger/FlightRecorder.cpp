@@ -0,0 +1,41 @@
+#include "FlightRecorder.h"
+#include "LoggerInternal.h"
+
+void FlightRecorder::fire(const std::string &reason, std::chrono::steady_clock::time_point now,
+                          const Writer &write) {
+  // Already writing through, just extend the window
+  if (now < until) {
+    until = now + post;
+    return;
+  }
+  ALOGI("Flight recorder triggered by '%s', writing %zu buffered records", reason.c_str(),
+        window.size());
+  write("--------- flight recorder triggered by '" + reason + "'");
+  for (const auto &l : window)
+    write(l);
+  window.clear();
+  bytes = 0;
+  until = now + post;
+}
+
+void FlightRecorder::record(const std::string &line, const Writer &write) {
+  const auto now = std::chrono::steady_clock::now();
+
+  for (const auto &t : triggers) {
+    if (line.find(t) != std::string::npos) {
+      fire(t, now, write);
+      break;
+    }
+  }
+
+  if (now < until) {
+    write(line);
+    return;
+  }
+  window.emplace_back(line);
+  bytes += line.size();
+  while (bytes > capacity && !window.empty()) {
+    bytes -= window.front().size();
+    window.pop_front();
+  }
+}
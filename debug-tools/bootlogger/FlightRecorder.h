@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Flight recorder mode of a LoggerContext.
+ * Keeps only the newest records in memory, and writes them out only when
+ * a trigger fires, followed by everything captured during the next
+ * 'post' duration.
+ */
+struct FlightRecorder {
+  using Writer = std::function<void(const std::string &line)>;
+
+  /**
+   * @param capacity bytes of records to keep in memory
+   * @param post how long to keep writing after a trigger
+   * @param triggers substrings which fire the trigger when found in a record
+   */
+  FlightRecorder(size_t capacity, std::chrono::seconds post, std::vector<std::string> triggers)
+      : capacity(capacity), post(post), triggers(std::move(triggers)) {}
+
+  /**
+   * Feed a record to the recorder
+   *
+   * @param line the record
+   * @param write invoked for each record to be written out
+   */
+  void record(const std::string &line, const Writer &write);
+
+  /**
+   * Fire the trigger now, not serialized against record()
+   *
+   * @param write invoked for each record to be written out
+   */
+  void trigger(const Writer &write) {
+    fire("request", std::chrono::steady_clock::now(), write);
+  }
+
+ private:
+  void fire(const std::string &reason, std::chrono::steady_clock::time_point now,
+            const Writer &write);
+
+  size_t capacity;
+  std::chrono::seconds post;
+  std::vector<std::string> triggers;
+  std::deque<std::string> window;
+  size_t bytes = 0;
+  std::chrono::steady_clock::time_point until{};
+};
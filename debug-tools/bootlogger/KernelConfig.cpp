@@ -1,54 +1,86 @@
 #include <sys/stat.h>
 #include <zlib.h>
 
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
-#include <regex>
-#include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "LoggerInternal.h"
 
-size_t getPageSize() {
-  static size_t pagesize = sysconf(_SC_PAGESIZE);
-  return pagesize;
-}
-
 static constexpr char kProcConfigGz[] = "/proc/config.gz";
 
-static int ReadConfigGz(std::string &out) {
-  char buf[BUF_SIZE];
-  size_t len;
-  gzFile f = gzopen(kProcConfigGz, "rb");
+// Reads plain files as well, zlib passes them through
+static int ReadConfigGz(const std::string &path, std::string &out) {
+  gzFile f = gzopen(path.c_str(), "rb");
   if (f == nullptr) {
     PLOGE("gzopen");
     return -errno;
   }
-  while ((len = gzread(f, buf, sizeof(buf)))) {
-    out.append(buf, len);
-  }
+  gzbuffer(f, 128 * 1024);
+  int len;
+  do {
+    const size_t size = out.size();
+    out.resize(size + 64 * 1024);
+    len = gzread(f, out.data() + size, out.size() - size);
+    out.resize(size + std::max(len, 0));
+  } while (len > 0);
   if (len < 0) {
     int errnum;
     const char *errmsg = gzerror(f, &errnum);
-    ALOGE("Could not read %s, %s", kProcConfigGz, errmsg);
+    ALOGE("Could not read %s, %s", path.c_str(), errmsg);
+    gzclose(f);
     return (errnum == Z_ERRNO ? -errno : errnum);
   }
   gzclose(f);
   return 0;
 }
 
-static bool parseOneConfigLine(const std::string &line, KernelConfig_t &outvec) {
-  static const std::regex kDisabledConfig(R"(^#\sCONFIG_\w+ is not set$)");
-  static const std::regex kEnabledConfig(R"(^CONFIG_\w+=(y|m|(")?(.+)?(")?)$)");
-  static const auto flags = std::regex_constants::format_sed;
-  std::string config;
-  bool ret = false;
+static bool isConfigName(std::string_view name) {
+  if (name.size() <= 7 || name.substr(0, 7) != "CONFIG_")
+    return false;
+  for (const char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_')
+      return false;
+  }
+  return true;
+}
+
+// Hand parsed, this runs on every boot
+static bool parseOneConfigLine(std::string_view line, KernelConfig_t &outvec,
+                               KernelConfigValues_t *values) {
+  static constexpr std::string_view kNotSet = " is not set";
+  std::string_view config, text;
   ConfigValue value = ConfigValue::UNKNOWN;
 
-  ret = std::regex_match(line, kEnabledConfig, flags);
-  if (ret) {
-    char c = line[line.find('=') + 1];
-    switch (c) {
+  if (line.empty())
+    return true;
+  if (line.front() == '#') {
+    // # CONFIG_AAA is not set
+    if (line.size() > 2 + kNotSet.size() && line[1] == ' ' &&
+        line.substr(line.size() - kNotSet.size()) == kNotSet) {
+      config = line.substr(2, line.size() - 2 - kNotSet.size());
+      if (isConfigName(config)) {
+        value = ConfigValue::UNSET;
+        text = "n";
+      }
+    }
+    // Else just a comment
+    if (value == ConfigValue::UNKNOWN)
+      return true;
+  } else {
+    // CONFIG_AAA=y
+    // = symbol being the delimiter
+    const auto eq = line.find('=');
+    config = line.substr(0, eq);
+    if (eq == std::string_view::npos || eq + 1 == line.size() || !isConfigName(config)) {
+      ALOGW("Unparsable line: '%.*s'", static_cast<int>(line.size()), line.data());
+      return false;
+    }
+    text = line.substr(eq + 1);
+    switch (text.front()) {
       case 'y':
         value = ConfigValue::BUILT_IN;
         break;
@@ -63,60 +95,24 @@ static bool parseOneConfigLine(const std::string &line, KernelConfig_t &outvec)
         value = ConfigValue::INT;
         break;
       default:
-        ALOGW("Unknown config value: %c", c);
-        return ret;
+        ALOGW("Unknown config value: %c", text.front());
+        return true;
     };
-  } else {
-    ret = std::regex_match(line, kDisabledConfig, flags);
-    if (ret) {
-      value = ConfigValue::UNSET;
-    } else {
-      // Is it a comment or newline?
-      // Assume OK first
-      ret = true;
-      if (!line.empty()) {
-        ret = line.front() == '#';
-        if (!ret) {
-          ALOGW("Unparsable line: '%s'", line.c_str());
-        }
-      }
-      return ret;
-    }
-  }
-  // Trim out CONFIG_* part
-  switch (value) {
-    case BUILT_IN:
-    case MODULE:
-    case STRING:
-    case INT:
-      // CONFIG_AAA=y
-      // = symbol being the delimiter
-      config = line.substr(0, line.find_first_of('='));
-      break;
-    case UNSET:
-      // # CONFIG_AAA is not set
-      // Space after AAA being the delimiter.
-      // '# ', size 2
-      config = line.substr(2);
-      config = config.substr(0, config.find_first_of(' '));
-      break;
-    case UNKNOWN:
-      __builtin_unreachable();
-      break;
   }
 
   outvec.emplace(config, value);
-  return ret;
+  if (values != nullptr)
+    values->emplace(config, text);
+  return true;
 }
 
-int ReadKernelConfig(KernelConfig_t &out) {
+int ReadKernelConfig(const std::string &path, KernelConfig_t &out, KernelConfigValues_t *values) {
   struct stat statbuf {};
-  std::string buf, line;
-  std::stringstream ss;
+  std::string buf;
   int rc = 0, lines = 0;
 
   // Determine config.gz size
-  rc = stat(kProcConfigGz, &statbuf);
+  rc = stat(path.c_str(), &statbuf);
   if (rc < 0) {
     PLOGE("stat");
     return -errno;
@@ -124,27 +120,36 @@ int ReadKernelConfig(KernelConfig_t &out) {
   // Linux uses gzip -9 ratio to compress, which has average ratio of 21%
   // Reserve string buffer size to avoid realloc's
   buf.reserve(statbuf.st_size * 5);
-  rc = ReadConfigGz(buf);
+  rc = ReadConfigGz(path, buf);
   if (rc < 0) {
     return rc;
   }
   // Clear if there was anything
   out.clear();
+  if (values != nullptr)
+    values->clear();
   // Determine map size by newlines
-  for (const char c : buf)
-    if (c == '\n') lines++;
+  lines = std::count(buf.begin(), buf.end(), '\n');
   // Avoid unnessary reallocs (Kernel configurations are a lot)
   out.reserve(lines);
+  if (values != nullptr)
+    values->reserve(lines);
   // Parse line by line
-  ss = std::stringstream(buf);
-  while (std::getline(ss, line)) {
+  std::string_view view(buf);
+  while (!view.empty()) {
+    const auto end = std::min(view.find('\n'), view.size());
     // Returns true (1) on success, so invert it to
     // make use of bitwise OR
-    rc |= !parseOneConfigLine(line, out);
+    rc |= !parseOneConfigLine(view.substr(0, end), out, values);
+    view.remove_prefix(std::min(end + 1, view.size()));
   }
   // If any of them returned false, rc would be 1
   if (rc) {
-    ALOGW("Error(s) were found parsing '%s'", kProcConfigGz);
+    ALOGW("Error(s) were found parsing '%s'", path.c_str());
   }
   return rc;
 }
+
+int ReadKernelConfig(KernelConfig_t &out) {
+  return ReadKernelConfig(kProcConfigGz, out);
+}
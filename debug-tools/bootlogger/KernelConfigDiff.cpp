@@ -0,0 +1,173 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+namespace {
+
+// Options known to affect performance, a trailing '*' matches a prefix
+struct PerfOption {
+  const char *name;
+  const char *reason;
+};
+
+constexpr PerfOption kPerfOptions[] = {
+    {"CONFIG_HZ", "timer tick rate"},
+    {"CONFIG_HZ_*", "timer tick rate"},
+    {"CONFIG_NO_HZ*", "tickless idle"},
+    {"CONFIG_PREEMPT*", "preemption model"},
+    {"CONFIG_AUDIT", "audit, AVC logging"},
+    {"CONFIG_KASAN*", "address sanitizer"},
+    {"CONFIG_UBSAN*", "undefined behaviour sanitizer"},
+    {"CONFIG_KCSAN", "data race sanitizer"},
+    {"CONFIG_KFENCE", "sampling memory error detector"},
+    {"CONFIG_KCOV", "coverage"},
+    {"CONFIG_LOCKDEP", "lock validator"},
+    {"CONFIG_PROVE_LOCKING", "lock validator"},
+    {"CONFIG_DEBUG_LOCK_ALLOC", "lock debugging"},
+    {"CONFIG_DEBUG_SPINLOCK", "lock debugging"},
+    {"CONFIG_DEBUG_MUTEXES", "lock debugging"},
+    {"CONFIG_DEBUG_ATOMIC_SLEEP", "sleep in atomic checks"},
+    {"CONFIG_SLUB_DEBUG*", "slab debugging"},
+    {"CONFIG_DEBUG_PAGEALLOC*", "page allocator debugging"},
+    {"CONFIG_PAGE_OWNER", "page allocation tracking"},
+    {"CONFIG_DEBUG_KMEMLEAK*", "memory leak detector"},
+    {"CONFIG_DEBUG_OBJECTS*", "object lifetime debugging"},
+    {"CONFIG_SCHED_DEBUG", "scheduler debugging"},
+    {"CONFIG_FTRACE", "tracing"},
+    {"CONFIG_FUNCTION_TRACER", "function tracing, mcount in every function"},
+    {"CONFIG_FUNCTION_GRAPH_TRACER", "function tracing"},
+    {"CONFIG_IRQSOFF_TRACER", "irqs-off latency tracing"},
+    {"CONFIG_PREEMPT_TRACER", "preempt-off latency tracing"},
+    {"CONFIG_TRACE_IRQFLAGS", "irq flag tracing"},
+    {"CONFIG_CPU_FREQ_DEFAULT_GOV_*", "default cpufreq governor"},
+};
+
+const PerfOption *findPerfOption(std::string_view name) {
+  for (const auto &opt : kPerfOptions) {
+    std::string_view pattern = opt.name;
+    if (pattern.back() == '*') {
+      pattern.remove_suffix(1);
+      if (name.substr(0, pattern.size()) == pattern)
+        return &opt;
+    } else if (name == pattern) {
+      return &opt;
+    }
+  }
+  return nullptr;
+}
+
+// "n" for options not set or not present
+const std::string &valueOf(const KernelConfigValues_t &values, const std::string &name) {
+  static const std::string kUnset = "n";
+  auto it = values.find(name);
+  return it == values.end() ? kUnset : it->second;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-p] [-r REFERENCE [-d]] [CONFIG]\n", argv0);
+  fprintf(stderr, "           -p: only show performance relevant options\n");
+  fprintf(stderr, "           -r: diff against a full .config or config.gz\n");
+  fprintf(stderr, "           -d: REFERENCE is a defconfig, only compare the options it names\n");
+  fprintf(stderr, "       CONFIG defaults to /proc/config.gz\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const char *reference = nullptr;
+  const char *config = "/proc/config.gz";
+  bool perf = false, defconfig = false;
+  KernelConfig_t types;
+  KernelConfigValues_t current, base;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "pr:d")) != -1) {
+    switch (opt) {
+      case 'p':
+        perf = true;
+        break;
+      case 'd':
+        defconfig = true;
+        break;
+      case 'r':
+        reference = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind < argc)
+    config = argv[optind++];
+  if (optind != argc || (!perf && reference == nullptr) || (defconfig && reference == nullptr)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (ReadKernelConfig(config, types, &current) < 0) {
+    fprintf(stderr, "Failed to read '%s'\n", config);
+    return EXIT_FAILURE;
+  }
+  if (reference != nullptr && ReadKernelConfig(reference, types, &base) < 0) {
+    fprintf(stderr, "Failed to read '%s'\n", reference);
+    return EXIT_FAILURE;
+  }
+
+  // Sorted union of both option names. A defconfig leaves out every option
+  // at its default, so then only the ones it names can be compared.
+  std::vector<std::string> names;
+  names.reserve(current.size() + base.size());
+  for (const auto *values : {&current, &base}) {
+    if (defconfig && values == &current)
+      continue;
+    for (const auto &[name, _] : *values)
+      names.emplace_back(name);
+  }
+  eraseDuplicates(names);
+
+  size_t added = 0, removed = 0, changed = 0;
+  for (const auto &name : names) {
+    const PerfOption *perfopt = perf ? findPerfOption(name) : nullptr;
+    if (perf && perfopt == nullptr)
+      continue;
+    const auto &now = valueOf(current, name);
+    if (reference == nullptr) {
+      // Just the relevant options set in config
+      if (now != "n")
+        printf("  %s=%s\t# %s\n", name.c_str(), now.c_str(), perfopt->reason);
+      continue;
+    }
+    const auto &was = valueOf(base, name);
+    if (now == was)
+      continue;
+    char mark;
+    if (was == "n") {
+      mark = '+';
+      added++;
+    } else if (now == "n") {
+      mark = '-';
+      removed++;
+    } else {
+      mark = '~';
+      changed++;
+    }
+    if (mark == '-')
+      printf("- %s (was %s)", name.c_str(), was.c_str());
+    else if (mark == '~')
+      printf("~ %s=%s (was %s)", name.c_str(), now.c_str(), was.c_str());
+    else
+      printf("+ %s=%s", name.c_str(), now.c_str());
+    if (perfopt != nullptr)
+      printf("\t# %s", perfopt->reason);
+    printf("\n");
+  }
+  if (reference != nullptr)
+    printf("%zu added, %zu removed, %zu changed\n", added, removed, changed);
+  return EXIT_SUCCESS;
+}
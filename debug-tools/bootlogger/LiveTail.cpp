@@ -0,0 +1,308 @@
+#include <cutils/sockets.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "LiveTail.h"
+#include "LoggerInternal.h"
+
+bool LiveTail::create(const std::string &name, size_t size) {
+  size_t data_size = BUF_SIZE;
+  while (data_size < size)
+    data_size <<= 1;
+
+  fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    PLOGE("memfd_create");
+    return false;
+  }
+  map_size = BUF_SIZE + data_size;
+  if (ftruncate(fd, map_size) < 0) {
+    PLOGE("ftruncate");
+    goto fail;
+  }
+  {
+    auto addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      PLOGE("mmap");
+      goto fail;
+    }
+    header = static_cast<TailHeader *>(addr);
+    data = static_cast<char *>(addr) + BUF_SIZE;
+  }
+  header->version = kTailVersion;
+  header->data_offset = BUF_SIZE;
+  header->data_size = data_size;
+  header->head = 0;
+  header->tail = 0;
+  __atomic_store_n(&header->magic, kTailMagic, __ATOMIC_RELEASE);
+
+  // Our mapping stays writable, but nobody else can map it writable
+  // or change its size after this.
+  {
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+    // Before Linux 5.1 this fails the whole call with EINVAL
+    if (fcntl(fd, F_ADD_SEALS, seals | F_SEAL_FUTURE_WRITE) == 0)
+      return true;
+    if (errno != EINVAL) {
+      PLOGE("F_ADD_SEALS");
+      goto fail;
+    }
+    ALOGW("F_SEAL_FUTURE_WRITE is not supported, readers could map the live tail writable");
+#endif
+    if (fcntl(fd, F_ADD_SEALS, seals) < 0) {
+      PLOGE("F_ADD_SEALS");
+      goto fail;
+    }
+  }
+  return true;
+
+fail:
+  close(fd);
+  fd = -1;
+  return false;
+}
+
+void LiveTail::copyIn(uint64_t pos, const void *src, size_t len) {
+  const size_t off = pos & (header->data_size - 1);
+  const size_t first = std::min<size_t>(len, header->data_size - off);
+  memcpy(data + off, src, first);
+  memcpy(data, static_cast<const char *>(src) + first, len - first);
+}
+
+void LiveTail::publish(const char *buf, size_t len) {
+  if (header == nullptr)
+    return;
+  len = std::min<size_t>(len, header->data_size / 2);
+
+  const uint32_t len32 = len;
+  const size_t need = TailAlign(sizeof(len32) + len);
+  const uint64_t head = header->head;
+  uint64_t tail = header->tail;
+
+  // Evict the oldest records first, so a reader seeing the new tail
+  // knows anything before it may be garbage.
+  if (head + need - tail > header->data_size) {
+    while (head + need - tail > header->data_size) {
+      uint32_t oldlen;
+      memcpy(&oldlen, data + (tail & (header->data_size - 1)), sizeof(oldlen));
+      tail += TailAlign(sizeof(oldlen) + oldlen);
+    }
+    __atomic_store_n(&header->tail, tail, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  copyIn(head, &len32, sizeof(len32));
+  copyIn(head + sizeof(len32), buf, len);
+  __atomic_store_n(&header->head, head + need, __ATOMIC_RELEASE);
+}
+
+LiveTail::~LiveTail() {
+  if (header != nullptr)
+    munmap(header, map_size);
+  if (fd >= 0)
+    close(fd);
+}
+
+bool LiveTailReader::attach(int memfd) {
+  struct stat statbuf {};
+
+  fd = memfd;
+  if (fstat(fd, &statbuf) < 0) {
+    PLOGE("fstat");
+    return false;
+  }
+  map_size = statbuf.st_size;
+  auto addr = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    PLOGE("mmap");
+    return false;
+  }
+  header = static_cast<const TailHeader *>(addr);
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != kTailMagic ||
+      header->version != kTailVersion ||
+      header->data_offset + header->data_size > map_size) {
+    ALOGE("Invalid live tail header");
+    return false;
+  }
+  data = static_cast<const char *>(addr) + header->data_offset;
+  cursor = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  return true;
+}
+
+uint64_t LiveTailReader::poll(
+    const std::function<void(std::string_view, std::string_view)> &callback) {
+  const size_t mask = header->data_size - 1;
+  const uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  uint64_t lost = 0;
+
+  while (cursor < head) {
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    if (cursor < tail) {
+      lost += tail - cursor;
+      cursor = tail;
+      continue;
+    }
+    uint32_t len;
+    memcpy(&len, data + (cursor & mask), sizeof(len));
+    const size_t off = (cursor + sizeof(len)) & mask;
+    if (len > header->data_size / 2) {
+      // Torn read of the length, the writer lapped us
+      lost += head - cursor;
+      cursor = head;
+      break;
+    }
+    const size_t first = std::min<size_t>(len, header->data_size - off);
+    callback(std::string_view(data + off, first), std::string_view(data, len - first));
+    // The writer may have overwritten the record while the callback read it
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    if (cursor < tail) {
+      lost += tail - cursor;
+      cursor = tail;
+      continue;
+    }
+    cursor += TailAlign(sizeof(len) + len);
+  }
+  return lost;
+}
+
+LiveTailReader::~LiveTailReader() {
+  if (header != nullptr)
+    munmap(const_cast<TailHeader *>(header), map_size);
+  if (fd >= 0)
+    close(fd);
+}
+
+void LiveTailServer::add(const std::string &name, const LiveTail *tail) {
+  tails.emplace(name, tail);
+}
+
+bool LiveTailServer::start(void) {
+  sockfd = android_get_control_socket(kTailSocketName);
+  if (sockfd < 0) {
+    ALOGW("No '%s' socket from init, live tail is not served", kTailSocketName);
+    return false;
+  }
+  if (listen(sockfd, 4) < 0) {
+    PLOGE("listen");
+    return false;
+  }
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd < 0) {
+    PLOGE("eventfd");
+    return false;
+  }
+  return true;
+}
+
+void LiveTailServer::stop(void) {
+  const uint64_t one = 1;
+  if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+    PLOGE("Failed to wake live tail server");
+}
+
+static void sendFd(int sock, int fd) {
+  char byte = fd >= 0 ? 0 : 1;
+  struct iovec iov = {&byte, sizeof(byte)};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } cmsgbuf {};
+  struct msghdr msg {};
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd >= 0) {
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+    PLOGE("sendmsg");
+}
+
+void LiveTailServer::serve(std::atomic_bool *run) {
+  struct pollfd pfds[] = {{sockfd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+
+  while (*run) {
+    if (::poll(pfds, 2, -1) <= 0 || !(pfds[0].revents & POLLIN))
+      continue;
+    int client = accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      PLOGE("accept4");
+      continue;
+    }
+    struct timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char name[64] = {0};
+    ssize_t len = recv(client, name, sizeof(name) - 1, 0);
+    if (len > 0) {
+      std::string key(name, strnlen(name, len));
+      while (!key.empty() && key.back() == '\n')
+        key.pop_back();
+      auto it = tails.find(key);
+      if (it != tails.end()) {
+        ALOGD("%s: Handing out '%s' live tail", __func__, key.c_str());
+        sendFd(client, it->second->getFd());
+      } else {
+        ALOGW("%s: No live tail named '%s'", __func__, key.c_str());
+        sendFd(client, -1);
+      }
+    }
+    close(client);
+  }
+}
+
+LiveTailServer::~LiveTailServer() {
+  if (wake_fd >= 0)
+    close(wake_fd);
+}
+
+int ConnectLiveTail(const std::string &name) {
+  char byte;
+  struct iovec iov = {&byte, sizeof(byte)};
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } cmsgbuf {};
+  struct msghdr msg {};
+  int fd = -1;
+
+  int sock = socket_local_client(kTailSocketName, ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_STREAM);
+  if (sock < 0)
+    return -errno;
+  std::string req = name + '\n';
+  if (send(sock, req.c_str(), req.size(), MSG_NOSIGNAL) < 0) {
+    int err = -errno;
+    close(sock);
+    return err;
+  }
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsgbuf.buf;
+  msg.msg_controllen = sizeof(cmsgbuf.buf);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0) {
+    int err = -errno;
+    close(sock);
+    return err ?: -ECONNRESET;
+  }
+  close(sock);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (byte != 0 || cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS)
+    return -ENOENT;
+  memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
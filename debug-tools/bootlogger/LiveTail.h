@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+/**
+ * Layout of the memfd backed live tail buffer.
+ *
+ * One writer (a LoggerContext) appends records, any number of readers map
+ * the memfd read-only and follow it with their own cursor.
+ * Positions are monotonic byte counts, the offset in the data region is
+ * position & (data_size - 1). Each record is a uint32_t length followed by
+ * the payload, padded to 4 bytes, so the length never wraps around.
+ * Before overwriting, the writer moves 'tail' past the records being
+ * overwritten, a reader whose cursor fell behind 'tail' has been overrun.
+ */
+static constexpr uint32_t kTailMagic = 0x4c494154;  // "TAIL"
+static constexpr uint32_t kTailVersion = 1;
+// Name of the init-created socket handing out the memfds
+static constexpr char kTailSocketName[] = "logger_tail";
+
+struct TailHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t data_offset;  // Offset of data region in the memfd
+  uint64_t data_size;    // Size of data region, a power of two
+  uint64_t head;         // Position after the newest record
+  uint64_t tail;         // Position of the oldest intact record
+};
+
+static inline size_t TailAlign(size_t len) {
+  return (len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+// Writer side, owned by a LoggerContext
+struct LiveTail {
+  /**
+   * Create the memfd and map it
+   *
+   * @param name name of the memfd, for debugging
+   * @param size requested data size, rounded up to a power of two
+   * @return true on success
+   */
+  bool create(const std::string &name, size_t size);
+
+  /**
+   * Publish one record to readers
+   *
+   * @param data the record
+   * @param len length of data
+   */
+  void publish(const char *data, size_t len);
+
+  // The memfd, to be passed to readers
+  int getFd() const { return fd; }
+
+  ~LiveTail();
+
+ private:
+  void copyIn(uint64_t pos, const void *src, size_t len);
+
+  int fd = -1;
+  size_t map_size = 0;
+  TailHeader *header = nullptr;
+  char *data = nullptr;
+};
+
+// Reader side
+struct LiveTailReader {
+  /**
+   * Map a tail memfd read-only, and start following from the newest record
+   *
+   * @param fd the memfd received from the logger, owned afterwards
+   * @return true on success
+   */
+  bool attach(int fd);
+
+  /**
+   * Read the records written since the last call, without copying them
+   *
+   * @param callback invoked per record with views into the mapping, the
+   *        second one is empty unless the record wraps around. They are
+   *        only valid during the callback and the writer may overwrite
+   *        them meanwhile, such a torn record is counted as lost.
+   * @return number of bytes lost because the writer overran this reader
+   */
+  uint64_t poll(const std::function<void(std::string_view first, std::string_view second)>
+                    &callback);
+
+  ~LiveTailReader();
+
+ private:
+  int fd = -1;
+  size_t map_size = 0;
+  const TailHeader *header = nullptr;
+  const char *data = nullptr;
+  uint64_t cursor = 0;
+};
+
+/**
+ * Serves the live tail memfds over the init-created unix socket.
+ * A client sends the context name (e.g. "logcat") and receives
+ * the memfd as SCM_RIGHTS ancillary data.
+ */
+struct LiveTailServer {
+  // Register a context's tail, must be done before start()
+  void add(const std::string &name, const LiveTail *tail);
+
+  /**
+   * Take the socket from init and start listening
+   *
+   * @return true if the socket was available
+   */
+  bool start(void);
+
+  /**
+   * Serve clients on the calling thread, until run is cleared and stop()
+   * is called
+   *
+   * @param run Pointer to run/stop control variable
+   */
+  void serve(std::atomic_bool *run);
+
+  // Wake serve() to look at its run variable
+  void stop(void);
+
+  ~LiveTailServer();
+
+ private:
+  int sockfd = -1;
+  int wake_fd = -1;
+  std::map<std::string, const LiveTail *> tails;
+};
+
+/**
+ * Connect to the logger and request the tail memfd of a context
+ *
+ * @param name context name
+ * @return the memfd, or negative errno
+ */
+int ConnectLiveTail(const std::string &name);
@@ -0,0 +1,42 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "LiveTail.h"
+#include "LoggerInternal.h"
+
+using std::chrono_literals::operator""ms;  // NOLINT (misc-unused-using-decls)
+
+int main(int argc, const char **argv) {
+  LiveTailReader reader;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s [context name, e.g. dmesg or logcat]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int fd = ConnectLiveTail(argv[1]);
+  if (fd < 0) {
+    fprintf(stderr, "%s: Cannot get live tail of '%s': %s\n", argv[0], argv[1], strerror(-fd));
+    return EXIT_FAILURE;
+  }
+  if (!reader.attach(fd)) {
+    fprintf(stderr, "%s: Cannot map live tail of '%s'\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+  while (true) {
+    auto lost = reader.poll([](std::string_view first, std::string_view second) {
+      fwrite(first.data(), 1, first.size(), stdout);
+      fwrite(second.data(), 1, second.size(), stdout);
+      fputc('\n', stdout);
+    });
+    if (lost > 0)
+      fprintf(stderr, "--- overrun: %llu bytes lost ---\n", static_cast<unsigned long long>(lost));
+    fflush(stdout);
+    std::this_thread::sleep_for(50ms);
+  }
+  return EXIT_SUCCESS;
+}
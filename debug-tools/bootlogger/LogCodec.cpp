@@ -0,0 +1,242 @@
+#include "LogCodec.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+// Beyond this, new tags are stored RAW
+static constexpr size_t kMaxTags = 65536;
+
+static void putVarint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+static bool getVarint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    const uint8_t byte = *p++;
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static void putBytes(std::string &out, std::string_view str) {
+  putVarint(out, str.size());
+  out.append(str);
+}
+
+static bool getBytes(const char *&p, const char *end, std::string_view &str) {
+  uint64_t len;
+  if (!getVarint(p, end, len) || len > static_cast<uint64_t>(end - p))
+    return false;
+  str = std::string_view(p, len);
+  p += len;
+  return true;
+}
+
+// Parse a fixed width decimal number
+static bool parseFixed(std::string_view s, size_t pos, size_t width, int64_t &out) {
+  if (pos + width > s.size())
+    return false;
+  out = 0;
+  for (size_t i = pos; i < pos + width; ++i) {
+    if (s[i] < '0' || s[i] > '9')
+      return false;
+    out = out * 10 + (s[i] - '0');
+  }
+  return true;
+}
+
+// Parse a decimal number after optional spaces, advancing pos
+static bool parseNumber(std::string_view s, size_t &pos, uint64_t &out) {
+  while (pos < s.size() && s[pos] == ' ')
+    ++pos;
+  if (pos >= s.size() || s[pos] < '0' || s[pos] > '9')
+    return false;
+  out = 0;
+  while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9')
+    out = out * 10 + (s[pos++] - '0');
+  return true;
+}
+
+// "MM-DD HH:MM:SS.mmm" as milliseconds, the same format comes back
+static std::string formatLogcat(int64_t ms, uint64_t pid, uint64_t tid, char prio,
+                                std::string_view tag, std::string_view msg) {
+  char buf[64];
+  const int64_t mmm = ms % 1000, sec = ms / 1000 % 60, min = ms / 60000 % 60,
+                hour = ms / 3600000 % 24, day = ms / 86400000 % 32, mon = ms / 2764800000;
+  int len = snprintf(buf, sizeof(buf), "%02" PRId64 "-%02" PRId64 " %02" PRId64 ":%02" PRId64
+                     ":%02" PRId64 ".%03" PRId64 " %5" PRIu64 " %5" PRIu64 " %c ",
+                     mon, day, hour, min, sec, mmm, pid, tid, prio);
+  std::string line(buf, len);
+  line.append(tag);
+  if (tag.size() < 8)
+    line.append(8 - tag.size(), ' ');
+  line.append(": ");
+  line.append(msg);
+  return line;
+}
+
+static std::string formatKmsg(uint64_t prio, int64_t us, std::string_view msg) {
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "<%" PRIu64 ">[%5" PRId64 ".%06" PRId64 "]", prio,
+                     us / 1000000, us % 1000000);
+  std::string line(buf, len);
+  line.append(msg);
+  return line;
+}
+
+bool LogEncoder::encodeLogcat(std::string_view line, std::string &out) {
+  int64_t mon, day, hour, min, sec, mmm;
+  uint64_t pid, tid;
+
+  if (!parseFixed(line, 0, 2, mon) || !parseFixed(line, 3, 2, day) ||
+      !parseFixed(line, 6, 2, hour) || !parseFixed(line, 9, 2, min) ||
+      !parseFixed(line, 12, 2, sec) || !parseFixed(line, 15, 3, mmm) || day > 31)
+    return false;
+  size_t pos = 18;
+  if (!parseNumber(line, pos, pid) || !parseNumber(line, pos, tid))
+    return false;
+  if (pos + 3 > line.size() || line[pos] != ' ' || line[pos + 2] != ' ')
+    return false;
+  const char prio = line[pos + 1];
+  pos += 3;
+  const size_t colon = line.find(": ", pos);
+  if (colon == std::string_view::npos)
+    return false;
+  auto tag = line.substr(pos, colon - pos);
+  while (!tag.empty() && tag.back() == ' ')
+    tag.remove_suffix(1);
+  const auto msg = line.substr(colon + 2);
+  const int64_t ms = ((((mon * 32 + day) * 24 + hour) * 60 + min) * 60 + sec) * 1000 + mmm;
+
+  // Only if it round trips, e.g. tags with trailing spaces don't
+  if (formatLogcat(ms, pid, tid, prio, tag, msg) != line)
+    return false;
+
+  scratch.assign(tag);
+  auto it = tags.find(scratch);
+  if (it == tags.end() && tags.size() >= kMaxTags)
+    return false;
+  out.push_back(LOGCAT);
+  putVarint(out, zigzag(ms - last_logcat_ms));
+  putVarint(out, pid);
+  putVarint(out, tid);
+  out.push_back(prio);
+  if (it != tags.end()) {
+    putVarint(out, it->second);
+  } else {
+    putVarint(out, tags.size());
+    putBytes(out, tag);
+    tags.emplace(scratch, tags.size());
+  }
+  putBytes(out, msg);
+  last_logcat_ms = ms;
+  return true;
+}
+
+bool LogEncoder::encodeKmsg(std::string_view line, std::string &out) {
+  uint64_t prio, secs, usecs;
+  size_t pos = 1;
+
+  if (!parseNumber(line, pos, prio) || pos + 1 >= line.size() || line[pos] != '>' ||
+      line[pos + 1] != '[')
+    return false;
+  pos += 2;
+  if (!parseNumber(line, pos, secs) || pos >= line.size() || line[pos] != '.')
+    return false;
+  const size_t frac = ++pos;
+  if (!parseNumber(line, pos, usecs) || pos - frac != 6 || pos >= line.size() || line[pos] != ']')
+    return false;
+  const auto msg = line.substr(pos + 1);
+  const int64_t us = secs * 1000000 + usecs;
+
+  if (formatKmsg(prio, us, msg) != line)
+    return false;
+  out.push_back(KMSG);
+  putVarint(out, prio);
+  putVarint(out, zigzag(us - last_kmsg_us));
+  putBytes(out, msg);
+  last_kmsg_us = us;
+  return true;
+}
+
+void LogEncoder::encode(std::string_view line, std::string &out) {
+  if (!line.empty()) {
+    if (line.front() == '<' && encodeKmsg(line, out))
+      return;
+    if (line.front() >= '0' && line.front() <= '9' && encodeLogcat(line, out))
+      return;
+  }
+  out.push_back(RAW);
+  putBytes(out, line);
+}
+
+void LogEncoder::reset(std::string &out) {
+  *this = LogEncoder();
+  out.push_back(RESET);
+}
+
+bool LogDecoder::decode(const char *&data, const char *end, std::string &line) {
+  const char *p = data;
+  std::string_view str, tag;
+  uint64_t v, pid, tid, id;
+
+  for (; p < end && *p == RESET; ++p)
+    *this = LogDecoder();
+  if (p >= end)
+    return false;
+  switch (static_cast<uint8_t>(*p++)) {
+    case RAW:
+      if (!getBytes(p, end, str))
+        return false;
+      line.assign(str);
+      break;
+    case LOGCAT: {
+      if (!getVarint(p, end, v) || !getVarint(p, end, pid) || !getVarint(p, end, tid) ||
+          p >= end)
+        return false;
+      const char prio = *p++;
+      if (!getVarint(p, end, id))
+        return false;
+      if (id == tags.size()) {
+        if (!getBytes(p, end, tag))
+          return false;
+        tags.emplace_back(tag);
+      } else if (id > tags.size()) {
+        return false;
+      }
+      if (!getBytes(p, end, str))
+        return false;
+      last_logcat_ms += unzigzag(v);
+      line = formatLogcat(last_logcat_ms, pid, tid, prio, tags[id], str);
+      break;
+    }
+    case KMSG: {
+      uint64_t prio;
+      if (!getVarint(p, end, prio) || !getVarint(p, end, v) || !getBytes(p, end, str))
+        return false;
+      last_kmsg_us += unzigzag(v);
+      line = formatKmsg(prio, last_kmsg_us, str);
+      break;
+    }
+    default:
+      return false;
+  }
+  data = p;
+  return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Compact binary container for captured lines, stored as '.blog'.
+ *
+ * The file starts with kCodecMagic and kCodecVersion (uint32_t each),
+ * followed by records, each starting with a RecordType byte:
+ *   RAW:    varint length, bytes
+ *   LOGCAT: zigzag varint timestamp delta (ms), varint pid, varint tid,
+ *           priority char, varint tag id, varint message length, bytes
+ *           A tag id equal to the dictionary size defines a new tag,
+ *           followed by its varint length and bytes.
+ *   KMSG:   varint priority, zigzag varint timestamp delta (us),
+ *           varint message length, bytes
+ *   RESET:  no payload, the tag dictionary and timestamps start over.
+ *           Written at each sidecar index point, so decoding can start
+ *           at any indexed offset.
+ * Lines are only encoded as LOGCAT/KMSG if decoding gives back the exact
+ * same line, everything else is stored RAW.
+ */
+static constexpr uint32_t kCodecMagic = 0x474f4c42;  // "BLOG"
+static constexpr uint32_t kCodecVersion = 2;
+
+enum RecordType : uint8_t {
+  RAW = 0,
+  LOGCAT = 1,
+  KMSG = 2,
+  RESET = 3,
+};
+
+struct LogEncoder {
+  /**
+   * Encode a line, appending the record to out
+   *
+   * @param line the captured line, without new line
+   * @param out buffer to append to
+   */
+  void encode(std::string_view line, std::string &out);
+
+  /**
+   * Start over with an empty tag dictionary, appending a RESET record
+   *
+   * @param out buffer to append to
+   */
+  void reset(std::string &out);
+
+ private:
+  bool encodeLogcat(std::string_view line, std::string &out);
+  bool encodeKmsg(std::string_view line, std::string &out);
+
+  std::unordered_map<std::string, uint32_t> tags;
+  int64_t last_logcat_ms = 0;
+  int64_t last_kmsg_us = 0;
+  std::string scratch;
+};
+
+struct LogDecoder {
+  /**
+   * Decode one record, following any RESET records before it
+   *
+   * @param data input, advanced past the record on success
+   * @param end end of input
+   * @param line decoded line, without new line
+   * @return true on success, false on truncated or invalid input
+   */
+  bool decode(const char *&data, const char *end, std::string &line);
+
+ private:
+  std::vector<std::string> tags;
+  int64_t last_logcat_ms = 0;
+  int64_t last_kmsg_us = 0;
+};
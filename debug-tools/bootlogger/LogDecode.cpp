@@ -0,0 +1,56 @@
+#include <android-base/file.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "LogCodec.h"
+
+using android::base::ReadFileToString;
+
+static bool decodeFile(const char *path) {
+  std::string raw, line;
+  uint32_t header[2];
+
+  if (!ReadFileToString(path, &raw)) {
+    fprintf(stderr, "Failed to read '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+  if (raw.size() < sizeof(header)) {
+    fprintf(stderr, "'%s' is too small to be a binary log\n", path);
+    return false;
+  }
+  memcpy(header, raw.data(), sizeof(header));
+  // Version 1 is the same without RESET records
+  if (header[0] != kCodecMagic || header[1] == 0 || header[1] > kCodecVersion) {
+    fprintf(stderr, "'%s' has an invalid header\n", path);
+    return false;
+  }
+
+  LogDecoder decoder;
+  const char *p = raw.data() + sizeof(header);
+  const char *end = raw.data() + raw.size();
+  while (p < end && decoder.decode(p, end, line)) {
+    fwrite(line.data(), 1, line.size(), stdout);
+    fputc('\n', stdout);
+  }
+  // A truncated last record is expected if the logger was killed
+  if (p < end)
+    fprintf(stderr, "'%s': %zu trailing bytes could not be decoded\n", path,
+            static_cast<size_t>(end - p));
+  return true;
+}
+
+int main(int argc, const char **argv) {
+  bool ret = true;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [output.blog]...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i < argc; ++i)
+    ret &= decodeFile(argv[i]);
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Sparse sidecar index of a text or binary output, stored as '<output>.idx'.
+ *
+ * An IndexHeader followed by IndexEntry's, one written before the first
+ * record of every 'interval' bytes of output. Entries are sorted by all
+ * three fields, so lookups are a binary search on either of them.
+ */
+static constexpr uint32_t kIndexMagic = 0x5844494c;  // "LIDX"
+static constexpr uint32_t kIndexVersion = 1;
+static constexpr char kIndexSuffix[] = ".idx";
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t interval;  // Bytes of output between entries
+};
+
+struct IndexEntry {
+  uint64_t timestamp_ms;  // CLOCK_BOOTTIME when the record was written
+  uint64_t line;          // Line number of the record, 0-based
+  uint64_t offset;        // Byte offset of the record in the output
+};
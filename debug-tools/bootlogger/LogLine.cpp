@@ -0,0 +1,131 @@
+#include "LogLine.h"
+
+#include <cctype>
+
+std::string_view StripTimestamp(std::string_view line) {
+  if (line.empty())
+    return line;
+
+  if (line.front() == '<') {
+    // kmsg: <prio>[timestamp] msg
+    auto open = line.find('>');
+    if (open == std::string_view::npos || open + 1 >= line.size() || line[open + 1] != '[')
+      return line;
+    auto close = line.find(']', open);
+    if (close == std::string_view::npos)
+      return line;
+    auto pos = line.find_first_not_of(' ', close + 1);
+    return pos == std::string_view::npos ? line.substr(line.size()) : line.substr(pos);
+  }
+  if (isdigit(line.front())) {
+    // logcat: date time pid...
+    size_t pos = 0;
+    for (int field = 0; field < 2; ++field) {
+      pos = line.find(' ', pos);
+      if (pos == std::string_view::npos)
+        return line;
+      pos = line.find_first_not_of(' ', pos);
+      if (pos == std::string_view::npos)
+        return line;
+    }
+    return line.substr(pos);
+  }
+  return line;
+}
+
+std::string_view RateLimitKey(std::string_view line) {
+  if (line.empty())
+    return {};
+
+  if (line.front() == '<') {
+    auto end = line.find('>');
+    return end == std::string_view::npos ? std::string_view() : line.substr(0, end + 1);
+  }
+  // pid tid P tag: msg
+  auto body = StripTimestamp(line);
+  if (body.size() == line.size())
+    return {};
+  size_t pos = 0;
+  for (int field = 0; field < 3; ++field) {
+    pos = body.find_first_not_of(' ', pos);
+    if (pos == std::string_view::npos)
+      return {};
+    pos = body.find(' ', pos);
+    if (pos == std::string_view::npos)
+      return {};
+  }
+  pos = body.find_first_not_of(' ', pos);
+  auto end = body.find(':', pos);
+  if (pos == std::string_view::npos || end == std::string_view::npos)
+    return {};
+  auto tag = body.substr(pos, end - pos);
+  while (!tag.empty() && tag.back() == ' ')
+    tag.remove_suffix(1);
+  return tag;
+}
+
+LinePriority ParseLinePriority(char c) {
+  switch (toupper(c)) {
+    case 'V':
+      return PRIO_VERBOSE;
+    case 'D':
+      return PRIO_DEBUG;
+    case 'I':
+      return PRIO_INFO;
+    case 'W':
+      return PRIO_WARN;
+    case 'E':
+      return PRIO_ERROR;
+    case 'F':
+      return PRIO_FATAL;
+    default:
+      return PRIO_UNKNOWN;
+  }
+}
+
+LinePriority GetLinePriority(std::string_view line) {
+  if (line.empty())
+    return PRIO_UNKNOWN;
+
+  if (line.front() == '<') {
+    // <facility * 8 + level>
+    unsigned value = 0;
+    size_t pos = 1;
+    while (pos < line.size() && isdigit(line[pos]))
+      value = value * 10 + (line[pos++] - '0');
+    if (pos == 1 || pos >= line.size() || line[pos] != '>')
+      return PRIO_UNKNOWN;
+    switch (value & 7) {
+      case 0:  // KERN_EMERG
+      case 1:  // KERN_ALERT
+      case 2:  // KERN_CRIT
+        return PRIO_FATAL;
+      case 3:
+        return PRIO_ERROR;
+      case 4:
+        return PRIO_WARN;
+      case 5:  // KERN_NOTICE
+      case 6:
+        return PRIO_INFO;
+      default:
+        return PRIO_DEBUG;
+    }
+  }
+  // pid tid P tag: msg
+  auto body = StripTimestamp(line);
+  if (body.size() == line.size())
+    return PRIO_UNKNOWN;
+  size_t pos = 0;
+  for (int field = 0; field < 2; ++field) {
+    pos = body.find_first_not_of(' ', pos);
+    if (pos == std::string_view::npos)
+      return PRIO_UNKNOWN;
+    pos = body.find(' ', pos);
+    if (pos == std::string_view::npos)
+      return PRIO_UNKNOWN;
+  }
+  pos = body.find_first_not_of(' ', pos);
+  if (pos == std::string_view::npos || pos + 1 >= body.size() || body[pos + 1] != ' ')
+    return PRIO_UNKNOWN;
+  return ParseLinePriority(body[pos]);
+}
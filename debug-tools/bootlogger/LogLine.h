@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string_view>
+
+/**
+ * Strip the leading timestamp of a captured line.
+ * Understands kmsg lines ("<6>[   12.345678] msg")
+ * and logcat threadtime lines ("01-01 00:00:00.000  pid  tid P tag: msg").
+ *
+ * @param line the captured line
+ * @return the line without timestamp, or line as-is if none was found
+ */
+std::string_view StripTimestamp(std::string_view line);
+
+/**
+ * Get the rate limiting key of a captured line: the tag of logcat lines,
+ * or the "<facility/priority>" prefix of kmsg lines.
+ *
+ * @param line the captured line
+ * @return the key, or an empty view if none was found
+ */
+std::string_view RateLimitKey(std::string_view line);
+
+// Android log priorities, kmsg levels are mapped onto them
+enum LinePriority {
+  PRIO_UNKNOWN = 0,
+  PRIO_VERBOSE = 2,
+  PRIO_DEBUG,
+  PRIO_INFO,
+  PRIO_WARN,
+  PRIO_ERROR,
+  PRIO_FATAL,
+};
+
+/**
+ * Get the priority of a captured line: the priority letter of logcat
+ * lines, or the level of kmsg lines.
+ *
+ * @param line the captured line
+ * @return the priority, PRIO_UNKNOWN if none was found
+ */
+LinePriority GetLinePriority(std::string_view line);
+
+/**
+ * Parse a priority letter (V, D, I, W, E, F)
+ *
+ * @return the priority, PRIO_UNKNOWN if invalid
+ */
+LinePriority ParseLinePriority(char c);
@@ -0,0 +1,284 @@
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "LogCodec.h"
+#include "LogIndex.h"
+
+using android::base::EndsWith;
+using android::base::ReadFileToString;
+
+static void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-t FROM[,TO]] [-l FROM[,TO]] [output.txt|output.blog]\n", argv0);
+  fprintf(stderr, "           -t: print a window of time, in seconds since boot\n");
+  fprintf(stderr, "           -l: print a range of lines, 0-based\n");
+  fprintf(stderr, "       Rotated outputs (output.1.txt, output.2.txt, ...) are read first,\n");
+  fprintf(stderr, "       oldest to newest, and lines are counted across all of them\n");
+}
+
+// One output file and its index, in the order they were written
+struct Segment {
+  std::string path;
+  std::vector<IndexEntry> entries;
+  uint64_t first_line;  // Line number of its first record across all segments
+  uint64_t lines;
+  bool binary;          // A LogCodec file, decoded from the index entries on
+  std::string raw;      // Contents of a binary output
+};
+
+// Parse "FROM[,TO]", TO defaults to the end
+static bool parseRange(const char *arg, double &from, double &to) {
+  char *end;
+  from = strtod(arg, &end);
+  if (end == arg)
+    return false;
+  to = HUGE_VAL;
+  if (*end == ',') {
+    const char *next = end + 1;
+    to = strtod(next, &end);
+    if (end == next)
+      return false;
+  }
+  return *end == '\0' && from <= to;
+}
+
+// Print the bytes of the output in [begin, end), end may be past EOF
+static void printBytes(FILE *fp, uint64_t begin, uint64_t end) {
+  char buf[BUFSIZ];
+  if (fseeko(fp, begin, SEEK_SET) < 0)
+    return;
+  while (begin < end) {
+    size_t len = fread(buf, 1, std::min<uint64_t>(sizeof(buf), end - begin), fp);
+    if (len == 0)
+      break;
+    fwrite(buf, 1, len, stdout);
+    begin += len;
+  }
+}
+
+// Print lines [from, to], starting to count at entry
+static void printLines(FILE *fp, const IndexEntry &entry, uint64_t from, uint64_t to) {
+  char *line = nullptr;
+  size_t cap = 0;
+  uint64_t lineno = entry.line;
+
+  if (fseeko(fp, entry.offset, SEEK_SET) < 0)
+    return;
+  while (lineno <= to && getline(&line, &cap, fp) > 0) {
+    if (lineno >= from)
+      fputs(line, stdout);
+    ++lineno;
+  }
+  free(line);
+}
+
+/**
+ * Decode the records of a binary output from an index entry on. The
+ * encoder starts over at each entry, so a fresh decoder can too.
+ *
+ * @param raw the whole output
+ * @param entry where to start
+ * @param end byte offset to stop at, may be past the end
+ * @param from first line to print, counted like entry.line
+ * @param to last line to print
+ * @return number of the line after the last one decoded
+ */
+static uint64_t decodeLines(const std::string &raw, const IndexEntry &entry, uint64_t end,
+                            uint64_t from, uint64_t to) {
+  LogDecoder decoder;
+  std::string line;
+  uint64_t lineno = entry.line;
+
+  if (entry.offset >= raw.size())
+    return lineno;
+  const char *p = raw.data() + entry.offset;
+  const char *limit = raw.data() + std::min<uint64_t>(end, raw.size());
+  while (lineno <= to && p < limit && decoder.decode(p, limit, line)) {
+    if (lineno >= from) {
+      fwrite(line.data(), 1, line.size(), stdout);
+      fputc('\n', stdout);
+    }
+    ++lineno;
+  }
+  return lineno;
+}
+
+/**
+ * Read the sidecar index of an output
+ *
+ * @param path the output
+ * @param entries filled with the index entries
+ * @return an error message, empty on success
+ */
+static std::string loadIndex(const std::string &path, std::vector<IndexEntry> &entries) {
+  const std::string index = path + kIndexSuffix;
+  std::string raw;
+
+  if (!ReadFileToString(index, &raw) || raw.size() < sizeof(IndexHeader))
+    return "Cannot read index '" + index + "'";
+  IndexHeader header;
+  memcpy(&header, raw.data(), sizeof(header));
+  if (header.magic != kIndexMagic || header.version != kIndexVersion)
+    return "'" + index + "' is not a logger index";
+  entries.resize((raw.size() - sizeof(header)) / sizeof(IndexEntry));
+  memcpy(entries.data(), raw.data() + sizeof(header), entries.size() * sizeof(IndexEntry));
+  return "";
+}
+
+// Number of lines in the output, counting only past its last index entry
+static uint64_t countLines(FILE *fp, const std::vector<IndexEntry> &entries) {
+  char buf[BUFSIZ];
+  size_t len;
+
+  if (entries.empty() || fseeko(fp, entries.back().offset, SEEK_SET) < 0)
+    return 0;
+  uint64_t lines = entries.back().line;
+  while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+    lines += std::count(buf, buf + len, '\n');
+  return lines;
+}
+
+// Paths of the rotated siblings of output, oldest first, then output itself
+static std::vector<std::string> listSegments(const std::string &output) {
+  const size_t slash = output.rfind('/');
+  size_t dot = output.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = output.size();
+  const std::string stem = output.substr(0, dot), ext = output.substr(dot);
+  std::vector<std::string> paths;
+
+  // OutputContext::rotate() numbers them from 1 upwards
+  for (unsigned n = 1;; ++n) {
+    std::string path = stem + '.' + std::to_string(n) + ext;
+    if (access(path.c_str(), F_OK) < 0)
+      break;
+    paths.emplace_back(std::move(path));
+  }
+  paths.emplace_back(output);
+  return paths;
+}
+
+int main(int argc, char **argv) {
+  double tfrom = 0, tto = 0, lfrom = 0, lto = 0;
+  bool bytime = false, byline = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:l:")) != -1) {
+    switch (opt) {
+      case 't':
+        bytime = parseRange(optarg, tfrom, tto);
+        if (!bytime) {
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'l':
+        byline = parseRange(optarg, lfrom, lto);
+        if (!byline) {
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind + 1 != argc || bytime == byline) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<Segment> segments;
+  uint64_t nr_lines = 0;
+  for (const auto &path : listSegments(argv[optind])) {
+    const bool live = path == argv[optind];
+    Segment segment{path, {}, nr_lines, 0, false, {}};
+    const auto error = loadIndex(path, segment.entries);
+    if (!error.empty()) {
+      fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+      // A rotated output without an index is skipped, lines are then off
+      if (live)
+        return EXIT_FAILURE;
+      continue;
+    }
+    if (segment.entries.empty())
+      continue;
+    segment.binary = EndsWith(path, ".blog");
+    if (segment.binary) {
+      if (!ReadFileToString(path, &segment.raw)) {
+        fprintf(stderr, "%s: Cannot read '%s': %s\n", argv[0], path.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+      }
+      segment.lines =
+          decodeLines(segment.raw, segment.entries.back(), UINT64_MAX, UINT64_MAX, UINT64_MAX);
+    } else {
+      FILE *fp = fopen(path.c_str(), "re");
+      if (fp == nullptr) {
+        fprintf(stderr, "%s: Cannot open '%s': %s\n", argv[0], path.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+      }
+      segment.lines = countLines(fp, segment.entries);
+      fclose(fp);
+    }
+    nr_lines += segment.lines;
+    segments.emplace_back(std::move(segment));
+  }
+
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const auto &segment = segments[i];
+    const auto &entries = segment.entries;
+    if (bytime) {
+      const uint64_t from_ms = tfrom * 1000, to_ms = std::min(tto * 1000, 1e19);
+      // Entirely before FROM if the next output already started by then
+      if (i + 1 < segments.size() && segments[i + 1].entries.front().timestamp_ms <= from_ms)
+        continue;
+      // Last entry written at or before FROM, to the first one after TO
+      auto begin = std::upper_bound(entries.begin(), entries.end(), from_ms,
+                                    [](uint64_t v, const IndexEntry &e) { return v < e.timestamp_ms; });
+      if (begin != entries.begin())
+        --begin;
+      auto end = std::upper_bound(begin, entries.end(), to_ms,
+                                  [](uint64_t v, const IndexEntry &e) { return v < e.timestamp_ms; });
+      if (begin == end)
+        continue;
+      const uint64_t end_offset = end == entries.end() ? UINT64_MAX : end->offset;
+      if (segment.binary) {
+        decodeLines(segment.raw, *begin, end_offset, 0, UINT64_MAX);
+        continue;
+      }
+      FILE *fp = fopen(segment.path.c_str(), "re");
+      if (fp == nullptr)
+        continue;
+      printBytes(fp, begin->offset, end_offset);
+      fclose(fp);
+    } else {
+      const uint64_t from = lfrom, to = std::min(lto, 1e19);
+      if (to < segment.first_line || from >= segment.first_line + segment.lines)
+        continue;
+      const uint64_t first = std::max(from, segment.first_line) - segment.first_line;
+      auto it = std::upper_bound(entries.begin(), entries.end(), first,
+                                 [](uint64_t v, const IndexEntry &e) { return v < e.line; });
+      if (it != entries.begin())
+        --it;
+      if (segment.binary) {
+        decodeLines(segment.raw, *it, UINT64_MAX, first, to - segment.first_line);
+        continue;
+      }
+      FILE *fp = fopen(segment.path.c_str(), "re");
+      if (fp == nullptr)
+        continue;
+      printLines(fp, *it, first, to - segment.first_line);
+      fclose(fp);
+    }
+  }
+  return EXIT_SUCCESS;
+}
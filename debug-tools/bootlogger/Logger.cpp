@@ -16,10 +16,12 @@
 
 #include <android-base/file.h>
 #include <android-base/properties.h>
+#include <android-base/strings.h>
 #include <chrono>
 #include <cstdlib>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/sysinfo.h>
 #include <unistd.h>
@@ -32,93 +34,51 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "AvcBaseline.h"
+#include "AvcWorker.h"
+#include "ControlServer.h"
+#include "Deduplicator.h"
+#include "Demuxer.h"
+#include "FlightRecorder.h"
+#include "LiveTail.h"
+#include "LogLine.h"
 #include "LoggerInternal.h"
+#include "OutputContext.h"
+#include "RateLimiter.h"
+#include "ResourceGovernor.h"
+#include "RingBuffer.h"
+#include "SepolicyIndex.h"
+#include "StreamServer.h"
 
 using android::base::GetProperty;
 using android::base::GetBoolProperty;
+using android::base::GetUintProperty;
+using android::base::Join;
+using android::base::SetProperty;
+using android::base::Split;
 using android::base::WaitForProperty;
 using android::base::WriteStringToFile;
 using std::chrono_literals::operator""s; // NOLINT (misc-unused-using-decls)
+using std::chrono_literals::operator""ms; // NOLINT (misc-unused-using-decls)
 
 namespace fs = std::filesystem;
 
 #define MAKE_LOGGER_PROP(prop) "persist.ext.logdump." prop
 
-// Base context for outputs with file
-struct OutputContext {
-  // File path (absolute)  of this context.
-  // Note that .txt suffix is auto appended in constructor.
-  std::string kFilePath;
-  // Just the filename only
-  std::string kFileName;
-
-  // Takes one argument 'filename' without file extension
-  OutputContext(fs::path logDir, const std::string &filename) : kFileName(filename) {
-    kFilePath = logDir.append(kFileName + ".txt").string();
-  }
-
-  // Takes two arguments 'filename' and is_filter
-  OutputContext(const fs::path logDir, const std::string &filename, const bool isFilter)
-      : OutputContext(logDir, filename) {
-    is_filter = isFilter;
-  }
-
-  // No default constructor
-  OutputContext() = delete;
-
-  /**
-   * Open outfilestream.
-   */
-  bool openOutput(void) {
-    const char *kFilePathStr = kFilePath.c_str();
-    ALOGI("%s: Opening '%s'%s", __func__, kFilePathStr, is_filter ? " (filter)" : "");
-    fd = open(kFilePathStr, O_RDWR | O_CREAT, 0644);
-    if (fd < 0)
-      PLOGE("Failed to open '%s'", kFilePathStr);
-    return fd >= 0;
-  }
-
-  /**
-   * Writes the string to this context's file
-   *
-   * @param string data
-   */
-  void writeToOutput(const std::string &data) {
-    len += write(fd, data.c_str(), data.size());
-    len += write(fd, "\n", 1);
-    if (len > BUF_SIZE) {
-      fsync(fd);
-      len = 0;
-    }
-  }
-
-  operator bool() const { return fd >= 0; }
-
-  /**
-   * Cleanup
-   */
-  ~OutputContext() {
-    struct stat buf {};
-    int rc = fstat(fd, &buf);
-    if (rc == 0 && buf.st_size == 0) {
-      ALOGD("Deleting '%s' because it is empty", kFilePath.c_str());
-      std::remove(kFilePath.c_str());
-    }
-    close(fd);
-    fd = -1;
-  }
-
-private:
-  int fd = -1;
-  int len = 0;
-  bool is_filter = false;
-};
+// Subdirectory of log root holding ring files, kept across boots
+static constexpr char kRingDirName[] = "ring";
+// File in log root holding the AVC denials of previous boots
+static constexpr char kBaselineName[] = "avc.baseline";
+// Fires the flight recorder when set to true. Not persistent, so setting
+// and resetting it costs no flash write.
+static constexpr char kFlightRecorderTrigger[] = "ext.logdump.trigger";
 
 /**
  * Filter support to LoggerContext's stream and outputting to a file.
@@ -163,7 +123,7 @@ struct LoggerContext : OutputContext {
     if (ctx) {
       ALOGD("%s: registered filter '%s' to '%s' logger", __func__,
             ctx->kFilterName.c_str(), name.c_str());
-      filters.emplace(ctx, OutputContext(logDir, ctx->kFilterName + '.' + name,/*isFilter*/ true));
+      filters.try_emplace(ctx, logDir, ctx->kFilterName + '.' + name, /*isFilter*/ true);
     }
   }
 
@@ -174,6 +134,8 @@ struct LoggerContext : OutputContext {
    */
   void startLogger(std::atomic_bool *run) {
     char buf[512] = {0};
+
+    ResourceGovernor::get().applyThread(ResourceGovernor::CAPTURE);
     auto fp = openSource();
     if (fp) {
       if (openOutput()) {
@@ -187,22 +149,54 @@ struct LoggerContext : OutputContext {
           else
             ++it;
         }
+        if (startPassthrough() && passthrough(fp, run)) {
+          closeSource(fp);
+          return;
+        }
         while (*run) {
           auto ret = fgets(buf, sizeof(buf), fp);
           std::istringstream ss(buf);
           std::string line;
+          // One-shot sources like pstore are done at their end
+          if (!ret && feof(fp)) {
+            ALOGI("[Context %s] End of source", name.c_str());
+            break;
+          }
           if (ret) {
+            last_record = std::chrono::steady_clock::now().time_since_epoch().count();
             while (std::getline(ss, line)) {
+              nr_lines++;
+              nr_bytes += line.size() + 1;
+              // Uncontended, unless a control command is being served
+              const std::lock_guard<std::mutex> _(output_lock);
               for (auto &f : filters) {
                 std::string fline = line;
                 fline.shrink_to_fit();
                 if (f.first->filter(fline))
                   f.second.writeToOutput(fline);
               }
-              writeToOutput(line);
+              // Filters still see everything, only the output is leveled
+              const auto level = min_priority.load(std::memory_order_relaxed);
+              if (level != PRIO_UNKNOWN) {
+                const auto prio = GetLinePriority(line);
+                if (prio != PRIO_UNKNOWN && prio < level) {
+                  nr_below_level++;
+                  continue;
+                }
+              }
+              if (dedup)
+                dedup->record(line, output);
+              else
+                output(line);
+              tail.publish(line.c_str(), line.size());
             }
           }
         }
+        const std::lock_guard<std::mutex> _(output_lock);
+        if (dedup)
+          dedup->flush(output);
+        if (limiter)
+          limiter->report(recordWriter, /*force*/ true);
         // ofstream will auto close
       } else {
         PLOGE("[Context %s] Opening output '%s'", name.c_str(),
@@ -214,6 +208,160 @@ struct LoggerContext : OutputContext {
     }
   }
 
+  /**
+   * Copy the source to the output untouched with splice(2) if nothing needs
+   * to see its records, see startLogger()
+   *
+   * @param enable whether to
+   */
+  void setPassthrough(const bool enable) { allow_passthrough = enable; }
+
+  /**
+   * Publish this context's records to a memfd live tail
+   *
+   * @param size size of the shared buffer
+   * @return the tail, or nullptr on failure
+   */
+  const LiveTail *enableLiveTail(const size_t size) {
+    if (!tail.create(LOG_TAG "-" + name, size))
+      return nullptr;
+    return &tail;
+  }
+
+  /**
+   * Only write the records around a trigger, see FlightRecorder
+   */
+  void enableFlightRecorder(const size_t capacity, const std::chrono::seconds post,
+                            const std::vector<std::string> &triggers) {
+    ALOGI("[Context %s] Flight recorder mode, %zu bytes, %llds after triggers", name.c_str(),
+          capacity, static_cast<long long>(post.count()));
+    recorder = std::make_unique<FlightRecorder>(capacity, post, triggers);
+  }
+
+  // Collapse repeated records in this context's output
+  void enableDeduplication(void) {
+    ALOGI("[Context %s] Collapsing repeated records", name.c_str());
+    dedup = std::make_unique<Deduplicator>();
+  }
+
+  /**
+   * Rate limit this context's records per tag (logcat) or priority (kmsg)
+   *
+   * @param rate records per second allowed per key
+   * @param burst records allowed at once per key
+   */
+  void enableRateLimit(const double rate, const double burst) {
+    ALOGI("[Context %s] Rate limiting to %.1f/s, burst %.1f", name.c_str(), rate, burst);
+    limiter = std::make_unique<RateLimiter>(rate, burst);
+  }
+
+  /**
+   * Also write each record to a file per tag or process, see Demuxer
+   *
+   * @param logDir directory the per key directory is placed in
+   * @param key what to split records by
+   * @param only if not empty, only these keys get a file
+   * @param maxOpen most files to keep open at once
+   */
+  void enableDemux(const fs::path &logDir, const Demuxer::Key key,
+                   const std::vector<std::string> &only, const size_t maxOpen) {
+    ALOGI("[Context %s] Demultiplexing by %s, %zu files open at most", name.c_str(),
+          key == Demuxer::TAG ? "tag" : "pid", maxOpen);
+    demux = std::make_unique<Demuxer>(logDir / (name + ".demux"), key, only, maxOpen);
+  }
+
+  // Get this context's outputs onto storage, callable from any thread
+  void flushOutputs(void) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    flush();
+    for (auto &f : filters)
+      f.second.flush();
+    if (demux)
+      demux->flush();
+  }
+
+  /**
+   * Continue this context's output, its filters' and its demuxed files in
+   * new files, callable from any thread
+   *
+   * @return a line per output, with its rotated path or "not rotated"
+   */
+  std::string rotateOutputs(void) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    const auto describe = [](const std::string &what, const std::string &rotated) {
+      return what + ": " + (rotated.empty() ? "not rotated" : "rotated to " + rotated) + '\n';
+    };
+    std::string out = describe(name, rotate());
+    for (auto &f : filters) {
+      if (f.second)
+        out += describe(f.second.kFileName, f.second.rotate());
+    }
+    if (demux)
+      out += describe(name + " demux", demux->rotate());
+    return out;
+  }
+
+  /**
+   * Only output records of at least this priority
+   *
+   * @param prio the priority, PRIO_UNKNOWN to output everything
+   * @return false if the output is spliced, its records are never seen
+   */
+  bool setMinPriority(const LinePriority prio) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    if (splicing)
+      return false;
+    min_priority = prio;
+    return true;
+  }
+
+  /**
+   * Append this context's statistics
+   *
+   * @param out buffer to append lines to
+   */
+  void getStats(std::vector<std::string> &out) const {
+    out.emplace_back(name + ": " + std::to_string(nr_lines.load()) + " records, " +
+                     std::to_string(nr_bytes.load()) + " bytes captured");
+    if (limiter)
+      out.emplace_back(name + ": " + std::to_string(limiter->getDropped()) +
+                       " records dropped by rate limit");
+    if (nr_below_level > 0)
+      out.emplace_back(name + ": " + std::to_string(nr_below_level.load()) +
+                       " records below the filter level");
+    if (demux)
+      out.emplace_back(name + ": " + std::to_string(demux->getFiles()) + " demuxed files, " +
+                       std::to_string(demux->getReopens()) + " reopens");
+    if (nr_spliced > 0)
+      out.emplace_back(name + ": " + std::to_string(nr_spliced.load()) +
+                       " bytes passed through, records not counted");
+  }
+
+  // Write out the flight recorder's window now, if enabled, callable from any thread
+  void triggerFlightRecorder(void) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    if (recorder)
+      recorder->trigger([this](const std::string &l) { writeToOutput(l); });
+  }
+
+  const std::string &getName() const { return name; }
+
+  // Invoke fn for this context's output, and each filter's
+  void forEachOutput(const std::function<void(OutputContext &)> &fn) {
+    fn(*this);
+    for (auto &f : filters)
+      fn(f.second);
+  }
+
+  // Number of records captured so far, estimated from the bytes if spliced
+  uint64_t getRecords() const { return nr_lines + nr_spliced / kSplicedRecordSize; }
+
+  // When the last record was captured, the epoch if none was
+  std::chrono::steady_clock::time_point getLastRecord() const {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last_record.load()));
+  }
+
   LoggerContext(decltype(openSource) op, decltype(closeSource) cl, const fs::path logDir,
                 const std::string& name)
                 : OutputContext(logDir, name), openSource(op), closeSource(cl), name(name) {
@@ -221,9 +369,140 @@ struct LoggerContext : OutputContext {
   }
 
  private:
+  static constexpr size_t kSpliceChunk = 64 * 1024;
+  // Average record size, to count records which are spliced unseen
+  static constexpr size_t kSplicedRecordSize = 100;
+
+  // Whether no stage needs to see the records
+  bool canPassthrough(void) const {
+    return allow_passthrough && filters.empty() && !dedup && !limiter && !demux && !recorder &&
+           tail.getFd() < 0 && min_priority == PRIO_UNKNOWN && canSplice();
+  }
+
+  // Whether to splice, decided under the lock so setMinPriority() can't race it
+  bool startPassthrough(void) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    splicing = canPassthrough();
+    return splicing;
+  }
+
+  // Move up to len bytes from a pipe to the output
+  ssize_t spliceOut(const int from, const size_t len) {
+    const std::lock_guard<std::mutex> _(output_lock);
+    const ssize_t n = spliceToOutput(from, len);
+    if (n > 0) {
+      nr_spliced += n;
+      nr_bytes += n;
+      last_record = std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+    return n;
+  }
+
+  /**
+   * Move the source to the output through a pipe with splice(2), so the
+   * data is never copied to user space. A pipe source, like logcat's, is
+   * spliced into the output directly.
+   *
+   * @return false if the source cannot be spliced, before anything was
+   *         moved. The caller falls back to reading lines then.
+   */
+  bool passthrough(FILE *fp, std::atomic_bool *run) {
+    const int src = fileno(fp);
+    struct stat st {};
+    int pipefd[2] = {-1, -1};
+    bool fallback = false;
+
+    const bool isPipe = fstat(src, &st) == 0 && S_ISFIFO(st.st_mode);
+    if (!isPipe && pipe2(pipefd, O_CLOEXEC) < 0) {
+      PLOGE("[Context %s] Creating pipe", name.c_str());
+      return false;
+    }
+    while (*run) {
+      // Sources like trace_pipe block while idle, wake up to check run
+      struct pollfd pfd = {src, POLLIN, 0};
+      const int rc = poll(&pfd, 1, 200);
+      if (rc < 0 && errno != EINTR) {
+        PLOGE("[Context %s] poll", name.c_str());
+        break;
+      }
+      if (rc <= 0)
+        continue;
+      ssize_t n;
+      if (isPipe) {
+        n = spliceOut(src, kSpliceChunk);
+      } else {
+        n = splice(src, nullptr, pipefd[1], nullptr, kSpliceChunk,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno == EAGAIN)
+          continue;
+        // Everything in the pipe has to go out before reading again
+        for (ssize_t left = n, out; left > 0; left -= out) {
+          out = spliceOut(pipefd[0], left);
+          if (out <= 0) {
+            n = -1;
+            break;
+          }
+        }
+      }
+      // No splice support, e.g. /proc/kmsg has no splice_read on newer kernels
+      if (n < 0 && errno == EINVAL && nr_spliced == 0) {
+        ALOGI("[Context %s] Source cannot be spliced, reading lines", name.c_str());
+        splicing = false;
+        fallback = true;
+        break;
+      }
+      if (n < 0)
+        PLOGE("[Context %s] splice", name.c_str());
+      if (n == 0)
+        ALOGI("[Context %s] End of source", name.c_str());
+      if (n <= 0)
+        break;
+    }
+    if (!isPipe) {
+      close(pipefd[0]);
+      close(pipefd[1]);
+    }
+    return !fallback;
+  }
+
+  // Output stages after deduplication: rate limiting, demux, then flight recorder
+  void limitRecord(const std::string &line) {
+    if (limiter) {
+      limiter->report(recordWriter);
+      if (!limiter->allow(RateLimitKey(line)))
+        return;
+    }
+    if (demux)
+      demux->record(line);
+    writeRecord(line);
+  }
+  void writeRecord(const std::string &line) {
+    if (recorder)
+      recorder->record(line, [this](const std::string &l) { writeToOutput(l); });
+    else
+      writeToOutput(line);
+  }
+  const Deduplicator::Writer output = [this](const std::string &l) { limitRecord(l); };
+  const Deduplicator::Writer recordWriter = [this](const std::string &l) { writeRecord(l); };
+
   std::string name;
   std::unordered_map<std::shared_ptr<LogFilterContext>, OutputContext>
       filters;
+  LiveTail tail;
+  std::unique_ptr<FlightRecorder> recorder;
+  std::unique_ptr<Deduplicator> dedup;
+  std::unique_ptr<RateLimiter> limiter;
+  std::unique_ptr<Demuxer> demux;
+  // Taken per record by the capture thread, and by control commands
+  std::mutex output_lock;
+  std::atomic<LinePriority> min_priority = PRIO_UNKNOWN;
+  std::atomic_uint64_t nr_below_level = 0;
+  std::atomic_uint64_t nr_lines = 0;
+  std::atomic<std::chrono::steady_clock::rep> last_record = 0;
+  std::atomic_uint64_t nr_bytes = 0;
+  std::atomic_uint64_t nr_spliced = 0;
+  bool allow_passthrough = false;
+  std::atomic_bool splicing = false;
 };
 
 // DMESG
@@ -251,6 +530,32 @@ static void LogcatContext_closeSource(FILE *fp) {
   fclose(fp);
 }
 
+// Opens the first of paths that exists
+static FILE* openFirst(std::initializer_list<const char *> paths) {
+  for (const char *path : paths) {
+    auto fp = fopen(path, "re");
+    if (fp || errno != ENOENT)
+      return fp;
+  }
+  return nullptr;
+}
+static void FileContext_closeSource(FILE *fp) {
+  fclose(fp);
+}
+
+// Ftrace, note that reading consumes the trace buffer
+static FILE* TraceContext_openSource() {
+  return openFirst({"/sys/kernel/tracing/trace_pipe", "/sys/kernel/debug/tracing/trace_pipe"});
+}
+
+// Console of the previous boot, read once
+static FILE* PstoreContext_openSource() {
+  return openFirst({"/sys/fs/pstore/console-ramoops-0", "/sys/fs/pstore/console-ramoops"});
+}
+static FILE* LastKmsgContext_openSource() {
+  return openFirst({"/proc/last_kmsg"});
+}
+
 // Filters - AVC
 struct AvcFilterContext : LogFilterContext {
   bool filter(const std::string &line) const override {
@@ -259,16 +564,14 @@ struct AvcFilterContext : LogFilterContext {
         std::regex(R"(avc:\s+denied\s+\{(\s\w+)+\s\}\sfor\s)");
     bool match = std::regex_search(line, kAvcMessageRegEX, kRegexMatchflags);
     match &= line.find("untrusted_app") == std::string::npos;
-    if (match && _ctx) {
-      const std::lock_guard<std::mutex> _(_lock);
-      parseOneAvcContext(line, *_ctx);
-    }
+    // Parsed on the worker, not to stall the capture threads
+    if (match && _worker)
+      _worker->submit(line);
     return match;
   }
-  std::shared_ptr<AvcContexts> _ctx;
-  std::mutex& _lock;
-  AvcFilterContext(std::shared_ptr<AvcContexts> ctx, std::mutex& lock) :
-    LogFilterContext("avc"), _ctx(ctx), _lock(lock) {}
+  std::shared_ptr<AvcWorker> _worker;
+  AvcFilterContext(std::shared_ptr<AvcWorker> worker) :
+    LogFilterContext("avc"), _worker(worker) {}
   AvcFilterContext() = delete;
   ~AvcFilterContext() override = default;
 };
@@ -323,15 +626,104 @@ static void recordBootTime() {
   }
 }
 
+/**
+ * Load the policy to check generated rules against, with the neverallows
+ * of the CIL files that exist
+ *
+ * @return the policy, nullptr if disabled or it failed to load
+ */
+static std::unique_ptr<SepolicyIndex> loadSepolicyIndex(void) {
+  if (!GetBoolProperty(MAKE_LOGGER_PROP("policy_check"), true))
+    return nullptr;
+  auto policy = std::make_unique<SepolicyIndex>();
+  if (!policy->load(GetProperty(MAKE_LOGGER_PROP("policy"), kKernelPolicyPath)))
+    return nullptr;
+  for (const auto &cil : Split(GetProperty(MAKE_LOGGER_PROP("policy_cil"),
+                                           "/system/etc/selinux/plat_sepolicy.cil,"
+                                           "/system_ext/etc/selinux/system_ext_sepolicy.cil,"
+                                           "/vendor/etc/selinux/vendor_sepolicy.cil"), ",")) {
+    if (!cil.empty() && access(cil.c_str(), R_OK) == 0)
+      policy->loadNeverallows(cil);
+  }
+  return policy;
+}
+
+/**
+ * Write sepolicy.gen and the minimised sepolicy/<domain>.te files,
+ * replacing earlier ones. With a policy, also classify each rule into
+ * sepolicy.check, and leave the rules allowed already or conflicting with
+ * a neverallow out of the .te files.
+ *
+ * @param logDir directory to write to
+ * @param ctxs the aggregated contexts
+ * @param policy policy to check against, may be nullptr
+ * @param summary set to the verdict counts, if checked
+ * @return number of rules written to sepolicy.gen
+ */
+static size_t writeSepolicyGen(const fs::path &logDir, const AvcContexts &ctxs,
+                               const SepolicyIndex *policy, std::string &summary) {
+  std::vector<std::string> allowrules;
+  std::map<std::string, std::vector<std::string>> domains;
+  OutputContext seGenCtx(logDir, "sepolicy.gen");
+  OutputContext seCheckCtx(logDir, "sepolicy.check");
+  const auto teDir = logDir / "sepolicy";
+  std::error_code ec;
+
+  // Outputs are appended to, e.g. after snapshot-avc
+  std::remove(seGenCtx.kFilePath.c_str());
+  seGenCtx.openOutput();
+  writeAllowRules(ctxs, allowrules);
+  eraseDuplicates(allowrules);
+  for (const auto& l : allowrules)
+    seGenCtx.writeToOutput(l);
+
+  AvcContexts unresolved;
+  std::remove(seCheckCtx.kFilePath.c_str());
+  if (policy) {
+    size_t counts[SepolicyIndex::UNKNOWN + 1] = {};
+    seCheckCtx.openOutput();
+    for (const auto &ctx : ctxs) {
+      std::vector<std::string> rule;
+      writeAllowRules({ctx}, rule);
+      if (rule.empty())
+        continue;
+      const auto verdict = policy->check(ctx);
+      ++counts[verdict];
+      seCheckCtx.writeToOutput(std::string(SepolicyIndex::verdictName(verdict)) + ": " +
+                               rule.front());
+      if (verdict == SepolicyIndex::NEW || verdict == SepolicyIndex::UNKNOWN)
+        unresolved.emplace_back(ctx);
+    }
+    summary = "sepolicy: " + std::to_string(counts[SepolicyIndex::ALLOWED]) + " allowed, " +
+              std::to_string(counts[SepolicyIndex::NEW]) + " new, " +
+              std::to_string(counts[SepolicyIndex::NEVERALLOW]) + " neverallow, " +
+              std::to_string(counts[SepolicyIndex::UNKNOWN]) + " unknown";
+    ALOGI("%s", summary.c_str());
+  }
+
+  writeDomainPolicies(policy ? unresolved : ctxs, domains);
+  fs::remove_all(teDir, ec);
+  if (!domains.empty() && !fs::create_directory(teDir, ec)) {
+    ALOGE("Failed to create directory '%s': %s", teDir.c_str(), ec.message().c_str());
+    return allowrules.size();
+  }
+  for (const auto &[domain, rules] : domains) {
+    const auto path = (teDir / (domain + ".te")).string();
+    if (!WriteStringToFile(Join(rules, '\n') + '\n', path))
+      PLOGE("Failed to write '%s'", path.c_str());
+  }
+  return allowrules.size();
+}
+
 int main(int argc, const char** argv) {
   std::vector<std::thread> threads;
   std::atomic_bool run;
+  bool flightRecorder = false;
   std::error_code ec;
   std::string kLogRoot;
   KernelConfig_t kConfig;
   bool system_log = false;
   int rc;
-  std::mutex lock;
 
   if (argc != 2) {
     fprintf(stderr, "Usage: %s [log directory]\n", argv[0]);
@@ -366,14 +758,38 @@ int main(int argc, const char** argv) {
     kLogDir,
     "logcat"
   };
+  // Sources that go to their own file untouched, "trace,pstore,last_kmsg",
+  // none by default
+  std::vector<std::unique_ptr<LoggerContext>> kExtraCtxs;
+  for (const auto &source : Split(GetProperty(MAKE_LOGGER_PROP("sources"), ""), ",")) {
+    decltype(LoggerContext::openSource) op = nullptr;
+    if (source == "trace")
+      op = TraceContext_openSource;
+    else if (source == "pstore")
+      op = PstoreContext_openSource;
+    else if (source == "last_kmsg")
+      op = LastKmsgContext_openSource;
+    else if (!source.empty())
+      ALOGW("Unknown source '%s'", source.c_str());
+    if (op)
+      kExtraCtxs.emplace_back(
+          std::make_unique<LoggerContext>(op, FileContext_closeSource, kLogDir, source));
+  }
   auto kAvcCtx = std::make_shared<std::vector<AvcContext>>();
-  auto kAvcFilter = std::make_shared<AvcFilterContext>(kAvcCtx, lock);
+  // Denials per source domain, in buckets of 1s for 30 minutes by default
+  auto kAvcWorker = std::make_shared<AvcWorker>(
+      kAvcCtx, GetUintProperty<uint64_t>(MAKE_LOGGER_PROP("avc_rate_bucket_ms"), 1000),
+      GetUintProperty<size_t>(MAKE_LOGGER_PROP("avc_rate_buckets"), 1800));
+  auto kAvcFilter = std::make_shared<AvcFilterContext>(kAvcWorker);
   auto kLibcPropsFilter = std::make_shared<libcPropFilterContext>();
   bool ever_removed = false;
 
   ALOGI("Logger starting with logdir '%s' ...", kLogDir.c_str());
 
   for (auto const& ent : fs::directory_iterator(system_log ? kLogDir : fs::path(kLogRoot), ec)) {
+    // Ring files and the AVC baseline must survive a reboot
+    if (ent.path().filename() == kRingDirName || ent.path().filename() == kBaselineName)
+      continue;
     if (fs::is_directory(ent, ec))
       fs::remove_all(ent, ec);
     else
@@ -402,6 +818,7 @@ int main(int argc, const char** argv) {
     } else {
       ALOGI("Kernel configuration does not have CONFIG_AUDIT=y, disabling avc filters.");
       kAvcFilter.reset();
+      kAvcWorker.reset();
       kAvcCtx.reset();
     }
   }
@@ -414,44 +831,337 @@ int main(int argc, const char** argv) {
   }
   run = true;
 
+  // Before any thread is created, they inherit the affinity
+  ResourceGovernor::get().applyProcess();
+
+  // Optionally store the captured records in the compact binary format,
+  // the filters stay plain text. Read them back with logger-decode.
+  if (GetProperty(MAKE_LOGGER_PROP("format"), "text") == "binary") {
+    ALOGI("Using binary output format");
+    kDmesgCtx.setBackend(kLogDir, std::make_unique<BinaryOutputBackend>());
+    kLogcatCtx.setBackend(kLogDir, std::make_unique<BinaryOutputBackend>());
+  }
+
+  // In system mode, optionally keep only the newest N MB in a ring file
+  if (system_log) {
+    const size_t ringSize = GetUintProperty<size_t>(MAKE_LOGGER_PROP("ring_size"), 0);
+    if (ringSize > 0) {
+      auto kRingDir = fs::path(kLogRoot).append(kRingDirName);
+      fs::create_directory(kRingDir, ec);
+      if (ec) {
+        ALOGE("Failed to create directory '%s': %s", kRingDir.c_str(), ec.message().c_str());
+        ec.clear();
+      } else {
+        ALOGI("Using %zuMB ring files in '%s'", ringSize, kRingDir.c_str());
+        kDmesgCtx.setBackend(kRingDir, std::make_unique<RingBufferBackend>(ringSize << 20));
+        kLogcatCtx.setBackend(kRingDir, std::make_unique<RingBufferBackend>(ringSize << 20));
+      }
+    }
+  }
+
+  // In system mode, optionally only write the records around failures
+  const size_t recorderSize = GetUintProperty<size_t>(MAKE_LOGGER_PROP("flight_recorder"), 0);
+  if (system_log && recorderSize > 0) {
+    const auto post = std::chrono::seconds(
+        GetUintProperty<unsigned>(MAKE_LOGGER_PROP("flight_recorder_post"), 30));
+    const auto triggers = Split(GetProperty(MAKE_LOGGER_PROP("flight_recorder_triggers"),
+                                            "FATAL EXCEPTION,WATCHDOG KILLING SYSTEM PROCESS,"
+                                            "BUG:,Kernel panic"), ",");
+    for (auto *ctx : {&kDmesgCtx, &kLogcatCtx})
+      ctx->enableFlightRecorder(recorderSize << 20, post, triggers);
+    flightRecorder = true;
+    // Left over by a previous instance
+    SetProperty(kFlightRecorderTrigger, "false");
+    threads.emplace_back(std::thread([&] {
+      ResourceGovernor::get().applyThread(ResourceGovernor::BACKGROUND);
+      // Blocks until set, shutdown sets it too to wake this thread
+      while (WaitForProperty(kFlightRecorderTrigger, "true") && run) {
+        ALOGI("Flight recorder triggered by property");
+        kDmesgCtx.triggerFlightRecorder();
+        kLogcatCtx.triggerFlightRecorder();
+        SetProperty(kFlightRecorderTrigger, "false");
+      }
+    }));
+  }
+
+  // Collapse repeated records of the listed contexts
+  const auto kDedupContexts = Split(GetProperty(MAKE_LOGGER_PROP("dedup"), ""), ",");
+  for (auto *ctx : {&kDmesgCtx, &kLogcatCtx}) {
+    if (std::find(kDedupContexts.begin(), kDedupContexts.end(), ctx->getName()) !=
+        kDedupContexts.end())
+      ctx->enableDeduplication();
+  }
+
+  // Per tag/priority rate limits, "rate[,burst]" records per second
+  for (auto *ctx : {&kDmesgCtx, &kLogcatCtx}) {
+    const auto limit = Split(GetProperty(MAKE_LOGGER_PROP("ratelimit.") + ctx->getName(), ""), ",");
+    const double rate = std::atof(limit[0].c_str());
+    if (rate > 0)
+      ctx->enableRateLimit(rate, limit.size() > 1 ? std::atof(limit[1].c_str()) : rate);
+  }
+
+  // Per tag or process copies, "tag|pid[:KEY,...]", e.g. "tag:CameraProvider"
+  const size_t demuxMaxOpen = GetUintProperty<size_t>(MAKE_LOGGER_PROP("demux_max_open"), 32);
+  for (auto *ctx : {&kDmesgCtx, &kLogcatCtx}) {
+    const auto demux = GetProperty(MAKE_LOGGER_PROP("demux.") + ctx->getName(), "");
+    if (demux.empty())
+      continue;
+    const auto sep = demux.find(':');
+    const auto mode = demux.substr(0, sep);
+    std::vector<std::string> only;
+    if (sep != std::string::npos)
+      only = Split(demux.substr(sep + 1), ",");
+    if (mode == "tag" || mode == "pid")
+      ctx->enableDemux(kLogDir, mode == "tag" ? Demuxer::TAG : Demuxer::PID, only, demuxMaxOpen);
+    else
+      ALOGW("Unknown demux key '%s' for '%s'", mode.c_str(), ctx->getName().c_str());
+  }
+
+  // Share the captured records with other on-device readers
+  LiveTailServer kTailServer;
+  const size_t tailSize = GetUintProperty<size_t>(MAKE_LOGGER_PROP("tail_size"), 0);
+  if (tailSize > 0) {
+    for (auto *ctx : {&kDmesgCtx, &kLogcatCtx}) {
+      auto tail = ctx->enableLiveTail(tailSize << 10);
+      if (tail)
+        kTailServer.add(ctx->getName(), tail);
+    }
+    if (kTailServer.start())
+      threads.emplace_back(std::thread([&] {
+        ResourceGovernor::get().applyThread(ResourceGovernor::BACKGROUND);
+        kTailServer.serve(&run);
+      }));
+  }
+
+  if (kAvcWorker)
+    kAvcWorker->start();
+
   // If this prop is true, logd logs kernel message to logcat
   // Don't make duplicate (Also it will race against kernel logs)
-  if (!GetBoolProperty("ro.logd.kernel", false)) {
+  const bool kCaptureDmesg = !GetBoolProperty("ro.logd.kernel", false);
+  if (kCaptureDmesg)
     kDmesgCtx.registerLogFilter(kLogDir, kAvcFilter);
-    threads.emplace_back(std::thread([&] { kDmesgCtx.startLogger(&run); }));
-  }
   kLogcatCtx.registerLogFilter(kLogDir, kAvcFilter);
   kLogcatCtx.registerLogFilter(kLogDir, kLibcPropsFilter);
+
+  // Stream the outputs, and the filters', to local clients
+  StreamServer kStreamServer(
+      GetUintProperty<size_t>(MAKE_LOGGER_PROP("stream_buffer_kb"), 256) << 10,
+      std::chrono::milliseconds(GetUintProperty<uint64_t>(MAKE_LOGGER_PROP("stream_block_ms"), 100)));
+  if (GetBoolProperty(MAKE_LOGGER_PROP("stream"), false)) {
+    for (auto *ctx : {&kDmesgCtx, &kLogcatCtx}) {
+      ctx->forEachOutput([&](OutputContext &out) {
+        out.setStream(kStreamServer.add(out.kFileName));
+      });
+    }
+    kStreamServer.start(&run);
+  }
+
+  // Optionally copy contexts nothing needs to look into with splice(2). Off
+  // by default, as their records can't be leveled or counted then.
+  const bool kPassthrough = GetBoolProperty(MAKE_LOGGER_PROP("passthrough"), false);
+  kDmesgCtx.setPassthrough(kPassthrough);
+  kLogcatCtx.setPassthrough(kPassthrough);
+  for (auto &ctx : kExtraCtxs)
+    ctx->setPassthrough(kPassthrough);
+
+  if (kCaptureDmesg)
+    threads.emplace_back(std::thread([&] { kDmesgCtx.startLogger(&run); }));
   threads.emplace_back(std::thread([&] { kLogcatCtx.startLogger(&run); }));
+  for (auto &ctx : kExtraCtxs)
+    threads.emplace_back(std::thread([&run, ctx = ctx.get()] { ctx->startLogger(&run); }));
+  // Serves control commands and writes the final outputs
+  ResourceGovernor::get().applyThread(ResourceGovernor::BACKGROUND);
 
-  if (system_log) {
-    WaitForProperty(MAKE_LOGGER_PROP("enabled"), "false");
-  } else {
-    WaitForProperty("sys.boot_completed", "1");
+  const auto kStartTime = std::chrono::steady_clock::now();
+  std::string drainStats, policyStats;
+  // Loaded on first use, the kernel policy takes a few MB
+  std::unique_ptr<SepolicyIndex> kPolicy;
+  bool policyLoaded = false;
+  auto getPolicy = [&] {
+    if (!policyLoaded) {
+      kPolicy = loadSepolicyIndex();
+      policyLoaded = true;
+    }
+    return kPolicy.get();
+  };
+  auto collectStats = [&] {
+    std::vector<std::string> stats;
+    if (!drainStats.empty())
+      stats.emplace_back(drainStats);
+    kDmesgCtx.getStats(stats);
+    kLogcatCtx.getStats(stats);
+    for (const auto &ctx : kExtraCtxs)
+      ctx->getStats(stats);
+    if (kAvcWorker)
+      stats.emplace_back("avc: " + std::to_string(kAvcWorker->getParsed()) + " denials parsed, " +
+                         std::to_string(kAvcWorker->getDropped()) + " dropped");
+    if (!policyStats.empty())
+      stats.emplace_back(policyStats);
+    kStreamServer.getStats(stats);
+    ResourceGovernor::getStats(stats);
+    return stats;
+  };
+
+  // Runtime control, served from the loop below
+  bool stopRequested = false;
+  ControlServer kControl;
+  kControl.add("status", "mode, uptime and capture statistics", [&](const auto &) {
+    std::string out = std::string("mode: ") + (system_log ? "system" : "boot") + '\n';
+    out += "uptime: " + std::to_string(duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - kStartTime).count()) + "s\n";
+    for (const auto &l : collectStats())
+      out += l + '\n';
+    return out;
+  });
+  kControl.add("flush", "get the outputs onto storage", [&](const auto &) {
+    kDmesgCtx.flushOutputs();
+    kLogcatCtx.flushOutputs();
+    for (auto &ctx : kExtraCtxs)
+      ctx->flushOutputs();
+    return std::string("flushed\n");
+  });
+  std::vector<LoggerContext *> kAllCtxs = {&kDmesgCtx, &kLogcatCtx};
+  for (auto &ctx : kExtraCtxs)
+    kAllCtxs.emplace_back(ctx.get());
+  kControl.add("rotate", "continue the outputs, filter outputs and demuxed files in new files",
+               [&](const auto &) {
+    std::string out;
+    for (auto *ctx : kAllCtxs)
+      out += ctx->rotateOutputs();
+    return out;
+  });
+  kControl.add("snapshot-avc", "write sepolicy.gen now", [&](const auto &) {
+    if (!kAvcWorker)
+      return std::string("AVC parsing is disabled\n");
+    const size_t rules = writeSepolicyGen(kLogDir, kAvcWorker->snapshot(), getPolicy(),
+                                          policyStats);
+    std::string out = std::to_string(rules) + " rules written to sepolicy.gen and sepolicy/\n";
+    if (kPolicy)
+      out += policyStats + '\n';
+    return out;
+  });
+  kControl.add("set-filter-level", "<context> <V|D|I|W|E|F|all>, lowest priority to output",
+               [&](const std::vector<std::string> &args) {
+    if (args.size() != 2 || args[1].empty())
+      return std::string("Usage: set-filter-level <context> <V|D|I|W|E|F|all>\n");
+    const auto prio = args[1] == "all" ? PRIO_UNKNOWN : ParseLinePriority(args[1][0]);
+    if (prio == PRIO_UNKNOWN && args[1] != "all")
+      return "Invalid level '" + args[1] + "'\n";
+    for (auto *ctx : kAllCtxs) {
+      if (ctx->getName() == args[0]) {
+        if (!ctx->setMinPriority(prio))
+          return ctx->getName() + ": output is spliced, records can't be leveled\n";
+        return ctx->getName() + ": level set to " + args[1] + '\n';
+      }
+    }
+    return "No context '" + args[0] + "'\n";
+  });
+  kControl.add("trigger", "fire the flight recorder", [&](const auto &) {
+    kDmesgCtx.triggerFlightRecorder();
+    kLogcatCtx.triggerFlightRecorder();
+    return std::string("triggered\n");
+  });
+  kControl.add("stop", "stop capturing and write the final outputs", [&](const auto &) {
+    stopRequested = true;
+    return std::string("stopping\n");
+  });
+  kControl.start();
+
+  const auto kStopProp = system_log ? MAKE_LOGGER_PROP("enabled") : "sys.boot_completed";
+  const auto kStopValue = system_log ? "false" : "1";
+  // Only wakes up for commands and the stop property
+  kControl.wakeOnProperty(kStopProp, kStopValue);
+  while (!stopRequested && GetProperty(kStopProp, "") != kStopValue)
+    kControl.poll();
+  if (!system_log && !stopRequested) {
     recordBootTime();
 
-    // Delay a bit to finish
-    std::this_thread::sleep_for(3s);
+    // Keep capturing the post-boot burst until the sources go quiet:
+    // nothing captured for drain_idle_ms, or fewer than drain_rate records
+    // per second, for drain_max_ms at most.
+    const auto kIdle = std::chrono::milliseconds(
+        GetUintProperty<uint64_t>(MAKE_LOGGER_PROP("drain_idle_ms"), 500));
+    const auto kMax = std::chrono::milliseconds(
+        GetUintProperty<uint64_t>(MAKE_LOGGER_PROP("drain_max_ms"), 10000));
+    const uint64_t kRate = GetUintProperty<uint64_t>(MAKE_LOGGER_PROP("drain_rate"), 20);
+    constexpr auto kTick = 100ms;
+    constexpr size_t kWindow = 10;  // Ticks the rate is measured over
+    std::vector<uint64_t> samples;
+    const char *reason = "max";
+
+    const auto start = std::chrono::steady_clock::now();
+    while (!stopRequested) {
+      const auto now = std::chrono::steady_clock::now();
+      const auto last = std::max(kDmesgCtx.getLastRecord(), kLogcatCtx.getLastRecord());
+      samples.emplace_back(kDmesgCtx.getRecords() + kLogcatCtx.getRecords());
+      if (now - last >= kIdle) {
+        reason = "idle";
+        break;
+      }
+      if (samples.size() > kWindow) {
+        samples.erase(samples.begin());
+        const auto window = duration_cast<std::chrono::milliseconds>(kTick * kWindow).count();
+        if (kRate > 0 && (samples.back() - samples.front()) * 1000 < kRate * window) {
+          reason = "rate";
+          break;
+        }
+      }
+      if (now - start >= kMax)
+        break;
+      kControl.poll(kTick);
+    }
+    if (stopRequested)
+      reason = "stop";
+    drainStats = "drain: " + std::to_string(duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count()) + "ms, ended by " + reason;
+    ALOGI("%s", drainStats.c_str());
   }
   run = false;
+  if (flightRecorder)
+    SetProperty(kFlightRecorderTrigger, "true");
+  kTailServer.stop();
   for (auto &i : threads)
     i.join();
+  if (kAvcWorker)
+    kAvcWorker->stop();
+
+  if (kAvcWorker) {
+    const auto csvPath = (kLogDir / "avc_rate.csv").string();
+    if (!WriteStringToFile(kAvcWorker->getRateCsv(), csvPath))
+      PLOGE("Failed to write '%s'", csvPath.c_str());
+  }
 
   if (kAvcCtx) {
     std::vector<std::string> allowrules;
-    OutputContext seGenCtx(kLogDir, "sepolicy.gen");
-    seGenCtx.openOutput();
 
-    for (auto& e1 : *kAvcCtx) {
-      for (auto& e2 : *kAvcCtx) {
-        if (&e1 == &e2) continue;
-        e1 += e2;
-      }
+    // Already merged by the worker
+    writeSepolicyGen(kLogDir, *kAvcCtx, getPolicy(), policyStats);
+
+    // Only the denials not seen in previous boots
+    AvcBaseline baseline;
+    if (baseline.load(fs::path(kLogRoot) / kBaselineName)) {
+      // Named like sepolicy.gen, which it is a subset of
+      OutputContext seNewCtx(kLogDir, "sepolicy.new.gen");
+      std::remove(seNewCtx.kFilePath.c_str());
+      seNewCtx.openOutput();
+      allowrules.clear();
+      writeAllowRules(baseline.update(*kAvcCtx), allowrules);
+      eraseDuplicates(allowrules);
+      for (const auto& l : allowrules)
+        seNewCtx.writeToOutput(l);
+      baseline.save();
+      ALOGI("AVC baseline has %zu permissions, %zu rules are new", baseline.size(),
+            allowrules.size());
     }
-    writeAllowRules(*kAvcCtx, allowrules);
-    eraseDuplicates(allowrules);
-    for (const auto& l : allowrules)
-      seGenCtx.writeToOutput(l);
+  }
+
+  // Last, to include the policy check
+  {
+    OutputContext statsCtx(kLogDir, "stats");
+    statsCtx.openOutput();
+    for (const auto& l : collectStats())
+      statsCtx.writeToOutput(l);
   }
   return 0;
 }
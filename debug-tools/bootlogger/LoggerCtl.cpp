@@ -0,0 +1,28 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "ControlServer.h"
+
+int main(int argc, const char **argv) {
+  std::string command, response;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s COMMAND [ARGS...]\n", argv[0]);
+    fprintf(stderr, "       %s help, for the commands\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i < argc; ++i) {
+    if (i > 1)
+      command += ' ';
+    command += argv[i];
+  }
+  int rc = SendControlCommand(command, response);
+  if (rc < 0) {
+    fprintf(stderr, "Failed to talk to the logger: %s\n", strerror(-rc));
+    return EXIT_FAILURE;
+  }
+  fputs(response.c_str(), stdout);
+  return EXIT_SUCCESS;
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <unistd.h>
+
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -14,7 +17,10 @@
   ALOGE("%s: " fmt ": %s", __func__, ##__VA_ARGS__, strerror(errno))
 
 // Caches sysconf(_SC_PAGESIZE) and returns it
-std::size_t getPageSize();
+inline std::size_t getPageSize() {
+  static const std::size_t pagesize = sysconf(_SC_PAGESIZE);
+  return pagesize;
+}
 // Alias
 #define BUF_SIZE getPageSize()
 
@@ -29,6 +35,8 @@ enum ConfigValue {
 };
 
 using KernelConfig_t = std::unordered_map<std::string, ConfigValue>;
+// Value text of each option, e.g. "y", "250", "\"foo\"", "n" if not set
+using KernelConfigValues_t = std::unordered_map<std::string, std::string>;
 
 /**
  * Read KernelConfig (/proc/config.gz)
@@ -39,6 +47,17 @@ using KernelConfig_t = std::unordered_map<std::string, ConfigValue>;
  */
 int ReadKernelConfig(KernelConfig_t& out);
 
+/**
+ * Read a kernel configuration, gzipped (config.gz) or plain (defconfig)
+ *
+ * @param path file to read
+ * @param out buffer to store
+ * @param values if not null, buffer to store the value texts
+ * @return 0 on success, else non-zero value
+ */
+int ReadKernelConfig(const std::string& path, KernelConfig_t& out,
+                     KernelConfigValues_t* values = nullptr);
+
 // AuditToAllow.cpp
 #include <algorithm>
 #include <map>
@@ -63,6 +82,7 @@ struct AvcContext {
   std::string scontext, tcontext;     // untrusted_app, init... Always enclosed with u:object_r: and :s0
   std::string tclass;                 // file, lnk_file, sock_file...
   AttributeMap misc_attributes;       // ino, dev, name, app...
+  std::vector<uint16_t> ioctlcmds;    // ioctlcmd of ioctl denials, sorted
   bool permissive;                    // enforced or not
   bool stale = false;                 // Whether this is used, used for merging contexts
   AvcContext &operator+=(AvcContext &other) {
@@ -78,6 +98,9 @@ struct AvcContext {
         operation.insert(operation.end(), other.operation.begin(),
                          other.operation.end());
         eraseDuplicates(operation);
+        ioctlcmds.insert(ioctlcmds.end(), other.ioctlcmds.begin(),
+                         other.ioctlcmds.end());
+        eraseDuplicates(ioctlcmds);
       }
     }
     return *this;
@@ -102,3 +125,23 @@ bool parseOneAvcContext(const std::string &str, AvcContexts &outvec);
  * @return true on success
  */
 void writeAllowRules(const AvcContexts &ctxs, std::vector<std::string>& out);
+
+/**
+ * writeDomainPolicies - generate minimised rules, per source domain
+ * Targets sharing a permission set are merged, permission sets are
+ * collapsed to global_macros, and ioctl commands become allowxperm ranges.
+ * Linear in the number of contexts.
+ *
+ * @param ctxs contexts to generate rules from
+ * @param out rules of each source domain, in the order first seen
+ */
+void writeDomainPolicies(const AvcContexts &ctxs,
+                         std::map<std::string, std::vector<std::string>> &out);
+
+/**
+ * TrimSEContext - get the type of a security context
+ *
+ * @param str context, e.g. u:object_r:system_file:s0
+ * @return the type, e.g. system_file, or str if it is not a context
+ */
+std::string TrimSEContext(const std::string &str);
@@ -0,0 +1,171 @@
+#include <android-base/strings.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LogIndex.h"
+#include "OutputContext.h"
+
+using android::base::Split;
+using std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  size_t lines = 200000;
+  size_t size = 120;
+  size_t rotate_every = 0;
+  size_t rate = 0;
+  // Durability modes to run each backend with, empty to follow the properties
+  std::vector<std::string> modes;
+  std::chrono::milliseconds period{0};
+};
+
+void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n LINES] [-s SIZE] [-r LINES] [-R RATE] [-d MODES] [-p MS] DIR\n",
+          argv0);
+  fprintf(stderr, "           -n: lines to write with each backend, default 200000\n");
+  fprintf(stderr, "           -s: bytes per line, default 120\n");
+  fprintf(stderr, "           -r: rotate every LINES lines, default never\n");
+  fprintf(stderr, "           -R: write RATE lines per second, default as fast as possible\n");
+  fprintf(stderr, "           -d: durability modes to compare, comma separated or 'all'\n");
+  fprintf(stderr, "           -p: durability period of range and datasync in ms\n");
+  fprintf(stderr, "       Compares write(2) and io_uring outputs in DIR. Without -d, follows the\n");
+  fprintf(stderr, "       persist.ext.logdump.durability properties like logger does\n");
+}
+
+double toUs(std::chrono::nanoseconds ns) {
+  return std::chrono::duration<double, std::micro>(ns).count();
+}
+
+// Latency at quantile q of sorted samples
+std::chrono::nanoseconds quantile(const std::vector<std::chrono::nanoseconds> &sorted, double q) {
+  if (sorted.empty())
+    return {};
+  return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))];
+}
+
+void removeOutput(const std::string &path) {
+  unlink(path.c_str());
+  unlink((path + kIndexSuffix).c_str());
+}
+
+bool run(const std::string &name, std::unique_ptr<FileOutputBackend> backend,
+         const std::string &dir, const Options &options) {
+  const std::string path = dir + "/iobench-" + name + ".txt";
+  const std::string rotated = dir + "/iobench-" + name + ".1.txt";
+  const std::string line(options.size, 'x');
+  std::vector<std::chrono::nanoseconds> calls;
+  std::chrono::nanoseconds max_rotate{};
+
+  removeOutput(path);
+  if (!backend->open(path)) {
+    fprintf(stderr, "Failed to open '%s'\n", path.c_str());
+    return false;
+  }
+  calls.reserve(options.lines);
+
+  const auto begin = steady_clock::now();
+  for (size_t i = 1; i <= options.lines; ++i) {
+    if (options.rate > 0)
+      std::this_thread::sleep_until(begin + std::chrono::microseconds(i * 1000000 / options.rate));
+    auto start = steady_clock::now();
+    backend->write(line.data(), line.size());
+    calls.emplace_back(steady_clock::now() - start);
+    if (options.rotate_every > 0 && i % options.rotate_every == 0) {
+      start = steady_clock::now();
+      if (!backend->rotate(path, rotated)) {
+        fprintf(stderr, "Failed to rotate '%s'\n", path.c_str());
+        return false;
+      }
+      max_rotate = std::max<std::chrono::nanoseconds>(max_rotate, steady_clock::now() - start);
+    }
+  }
+  // Includes waiting for the I/O still in flight
+  backend->flush();
+  const auto stats = backend->getIoStats();
+  backend.reset();
+  const auto total = steady_clock::now() - begin;
+
+  std::sort(calls.begin(), calls.end());
+  printf("%s: %zu lines in %.1f ms, %zu syscalls, %zu syncs\n", name.c_str(), options.lines,
+         toUs(total) / 1000, stats.syscalls, stats.syncs);
+  printf("  write() p50 %.1fus, p99 %.1fus, max %.1fus, I/O max %.1fus", toUs(quantile(calls, 0.5)),
+         toUs(quantile(calls, 0.99)), toUs(calls.back()), toUs(stats.max_io_latency));
+  if (options.rotate_every > 0)
+    printf(", rotate max %.1fus", toUs(max_rotate));
+  printf("\n");
+
+  removeOutput(path);
+  removeOutput(rotated);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:r:R:d:p:")) != -1) {
+    switch (opt) {
+      case 'n':
+        options.lines = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        options.size = strtoul(optarg, nullptr, 10);
+        break;
+      case 'r':
+        options.rotate_every = strtoul(optarg, nullptr, 10);
+        break;
+      case 'R':
+        options.rate = strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        options.modes = strcmp(optarg, "all") == 0
+                            ? std::vector<std::string>{"none", "range", "datasync", "strict"}
+                            : Split(optarg, ",");
+        break;
+      case 'p':
+        options.period = std::chrono::milliseconds(strtoul(optarg, nullptr, 10));
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1 || options.lines == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const std::string dir = argv[optind];
+  auto policy = DurabilityPolicy::get();
+  if (options.period.count() > 0)
+    policy.period = options.period;
+  if (options.modes.empty())
+    options.modes.emplace_back("");
+  for (const auto &mode : options.modes) {
+    std::string suffix;
+    if (!mode.empty()) {
+      if (!DurabilityPolicy::parseMode(mode, policy.mode)) {
+        fprintf(stderr, "Unknown durability mode '%s'\n", mode.c_str());
+        return EXIT_FAILURE;
+      }
+      suffix = '-' + mode;
+    }
+    DurabilityPolicy::set(policy);
+    if (!run("write" + suffix, std::make_unique<FileOutputBackend>(), dir, options) ||
+        !run("uring" + suffix, std::make_unique<UringOutputBackend>(), dir, options))
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,427 @@
+#include <android-base/properties.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "LogIndex.h"
+#include "LoggerInternal.h"
+#include "OutputContext.h"
+#include "StreamServer.h"
+
+namespace fs = std::filesystem;
+
+using android::base::GetBoolProperty;
+using android::base::GetProperty;
+using android::base::GetUintProperty;
+
+bool DurabilityPolicy::parseMode(const std::string &name, Mode &mode) {
+  if (name == "none")
+    mode = NONE;
+  else if (name == "range")
+    mode = RANGE;
+  else if (name == "datasync")
+    mode = DATASYNC;
+  else if (name == "strict")
+    mode = STRICT;
+  else
+    return false;
+  return true;
+}
+
+static DurabilityPolicy &currentPolicy(void) {
+  static DurabilityPolicy policy = [] {
+    // Boot capture wants to survive bootloops and panics, the long running
+    // system capture cares more about write amplification. See
+    // logger-iobench -d for the cost of each mode.
+    const bool system_log = getenv("LOGGER_MODE_SYSTEM") != nullptr;
+    const auto mode = GetProperty("persist.ext.logdump.durability",
+                                  system_log ? "range" : "datasync");
+    DurabilityPolicy policy{};
+
+    if (!DurabilityPolicy::parseMode(mode, policy.mode)) {
+      ALOGW("Unknown durability mode '%s', using strict", mode.c_str());
+      policy.mode = DurabilityPolicy::STRICT;
+    }
+    policy.period = std::chrono::milliseconds(GetUintProperty<uint64_t>(
+        "persist.ext.logdump.durability_period_ms", system_log ? 5000 : 1000));
+    policy.extent = GetUintProperty<size_t>("persist.ext.logdump.prealloc_kb", 1024) << 10;
+    ALOGD("Durability mode %s, period %lldms, prealloc %zuKB", mode.c_str(),
+          static_cast<long long>(policy.period.count()), policy.extent >> 10);
+    return policy;
+  }();
+  return policy;
+}
+
+const DurabilityPolicy &DurabilityPolicy::get(void) {
+  return currentPolicy();
+}
+
+void DurabilityPolicy::set(const DurabilityPolicy &policy) {
+  currentPolicy() = policy;
+}
+
+// Bytes of output between sidecar index entries, 0 disables the index
+static uint64_t getIndexInterval(void) {
+  static const uint64_t kInterval =
+      GetUintProperty<uint64_t>("persist.ext.logdump.index_interval", 64) << 10;
+  return kInterval;
+}
+
+std::unique_ptr<OutputBackend> OutputBackend::makeDefault(bool primary) {
+  static const bool kUseUring = GetBoolProperty("persist.ext.logdump.io_uring", false);
+  if (kUseUring && primary)
+    return std::make_unique<UringOutputBackend>();
+  return std::make_unique<FileOutputBackend>();
+}
+
+bool FileOutputBackend::open(const std::string &path) {
+  struct stat buf {};
+
+  // Not O_APPEND: io_uring writes at explicit offsets and splice(2) refuses
+  // it. Demuxed files get closed and reopened, so continue from the end.
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", path.c_str());
+    return false;
+  }
+  index_path = path + kIndexSuffix;
+  if (fstat(fd, &buf) == 0 && buf.st_size > 0) {
+    if (lseek(fd, 0, SEEK_END) < 0) {
+      PLOGE("Failed to seek '%s'", path.c_str());
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    bytes = allocated = synced = buf.st_size;
+    // Line numbers of the existing data are unknown
+    next_index = UINT64_MAX;
+  }
+  return true;
+}
+
+bool FileOutputBackend::indexDue(void) const {
+  return getIndexInterval() > 0 && bytes >= next_index;
+}
+
+void FileOutputBackend::account(size_t size) {
+  const uint64_t interval = getIndexInterval();
+
+  if (indexDue()) {
+    // Opened lazily, so empty outputs don't leave an index behind
+    if (index_fd < 0) {
+      IndexHeader header = {kIndexMagic, kIndexVersion, interval};
+      index_fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (index_fd < 0 || ::write(index_fd, &header, sizeof(header)) < 0) {
+        PLOGE("Failed to create index '%s'", index_path.c_str());
+        next_index = UINT64_MAX;
+      }
+    }
+    if (index_fd >= 0) {
+      struct timespec ts {};
+      clock_gettime(CLOCK_BOOTTIME, &ts);
+      IndexEntry entry = {static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000,
+                          lines, bytes};
+      if (::write(index_fd, &entry, sizeof(entry)) < 0)
+        PLOGE("Failed to write index '%s'", index_path.c_str());
+      nr_syscalls++;
+      next_index = bytes + interval;
+    }
+  }
+  bytes += size;
+  lines++;
+}
+
+std::pair<off_t, off_t> FileOutputBackend::preallocate(size_t size) {
+  const auto &policy = DurabilityPolicy::get();
+
+  if (policy.extent == 0 || static_cast<off_t>(bytes + size) <= allocated)
+    return {0, 0};
+  // Grow in large extents, so f2fs/ext4 don't fragment the file one
+  // write at a time. KEEP_SIZE so readers never see the zeroes.
+  std::pair<off_t, off_t> range = {allocated, policy.extent};
+  while (static_cast<off_t>(bytes + size) > range.first + range.second)
+    range.second += policy.extent;
+  allocated = range.first + range.second;
+  return range;
+}
+
+bool FileOutputBackend::syncDue(size_t dirty) {
+  const auto &policy = DurabilityPolicy::get();
+  const auto now = std::chrono::steady_clock::now();
+
+  switch (policy.mode) {
+    case DurabilityPolicy::NONE:
+      return false;
+    case DurabilityPolicy::STRICT:
+      return dirty > BUF_SIZE;
+    case DurabilityPolicy::RANGE:
+    case DurabilityPolicy::DATASYNC:
+      if (dirty == 0 || now - last_sync < policy.period)
+        return false;
+      last_sync = now;
+      return true;
+  }
+  return false;
+}
+
+void FileOutputBackend::reserve(size_t size) {
+  auto range = preallocate(size);
+  if (range.second > 0) {
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, range.first, range.second) < 0) {
+      // Not supported by the filesystem, don't try again
+      if (errno == EOPNOTSUPP)
+        allocated = INT64_MAX;
+    }
+    nr_syscalls++;
+  }
+}
+
+void FileOutputBackend::sync(void) {
+  if (syncDue(len)) {
+    switch (DurabilityPolicy::get().mode) {
+      case DurabilityPolicy::RANGE:
+        sync_file_range(fd, synced, bytes - synced, SYNC_FILE_RANGE_WRITE);
+        break;
+      case DurabilityPolicy::DATASYNC:
+        fdatasync(fd);
+        break;
+      default:
+        fsync(fd);
+        break;
+    }
+    synced = bytes;
+    len = 0;
+    nr_syncs++;
+    nr_syscalls++;
+  }
+}
+
+void FileOutputBackend::append(const struct iovec *iov, int iovcnt, size_t size) {
+  const auto start = std::chrono::steady_clock::now();
+
+  reserve(size);
+  const auto io_start = std::chrono::steady_clock::now();
+  const ssize_t written = writev(fd, iov, iovcnt);
+  max_io_latency = std::max(max_io_latency, std::chrono::steady_clock::now() - io_start);
+  nr_syscalls++;
+  if (written < 0) {
+    // e.g. ENOSPC, don't flood the log with it
+    if (!write_failed)
+      PLOGE("Failed to write fd %d", fd);
+    write_failed = true;
+    return;
+  }
+  // Only what reached the file, a short write keeps the partial record
+  account(written);
+  len += written;
+  sync();
+  max_call_latency = std::max(max_call_latency, std::chrono::steady_clock::now() - start);
+}
+
+ssize_t FileOutputBackend::splice(int pipe_fd, size_t size) {
+  const auto start = std::chrono::steady_clock::now();
+
+  reserve(size);
+  const auto io_start = std::chrono::steady_clock::now();
+  const ssize_t n = ::splice(pipe_fd, nullptr, fd, nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+  max_io_latency = std::max(max_io_latency, std::chrono::steady_clock::now() - io_start);
+  nr_syscalls++;
+  if (n <= 0)
+    return n;
+  // Record boundaries are unknown, so the index ends here
+  next_index = UINT64_MAX;
+  bytes += n;
+  len += n;
+  sync();
+  max_call_latency = std::max(max_call_latency, std::chrono::steady_clock::now() - start);
+  return n;
+}
+
+void FileOutputBackend::write(const char *data, size_t size) {
+  struct iovec iov[] = {
+    {const_cast<char *>(data), size},
+    {const_cast<char *>("\n"), 1},
+  };
+  append(iov, 2, size + 1);
+}
+
+bool FileOutputBackend::empty() const {
+  struct stat buf {};
+  int rc = fstat(fd, &buf);
+  return rc == 0 && buf.st_size == 0;
+}
+
+void FileOutputBackend::flush() {
+  if (fd < 0)
+    return;
+  fdatasync(fd);
+  synced = bytes;
+  len = 0;
+  nr_syncs++;
+  nr_syscalls++;
+}
+
+bool FileOutputBackend::rotate(const std::string &path, const std::string &rotated) {
+  close();
+  return renameClosed(path, rotated) && open(path);
+}
+
+bool FileOutputBackend::renameClosed(const std::string &path, const std::string &rotated) {
+  if (rename(path.c_str(), rotated.c_str()) < 0) {
+    PLOGE("Failed to rename '%s' to '%s'", path.c_str(), rotated.c_str());
+    return false;
+  }
+  const std::string rotated_index = rotated + kIndexSuffix;
+  if (rename(index_path.c_str(), rotated_index.c_str()) < 0 && errno != ENOENT)
+    PLOGE("Failed to rename '%s'", index_path.c_str());
+  len = 0;
+  allocated = 0;
+  synced = 0;
+  last_sync = {};
+  bytes = 0;
+  lines = 0;
+  next_index = 0;
+  return true;
+}
+
+void FileOutputBackend::logStats(void) const {
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  ALOGD("fd %d: %zu I/O syscalls, %zu syncs, max write latency %lldus, max I/O latency %lldus",
+        fd, nr_syscalls, nr_syncs,
+        static_cast<long long>(duration_cast<microseconds>(max_call_latency).count()),
+        static_cast<long long>(duration_cast<microseconds>(max_io_latency).count()));
+}
+
+void FileOutputBackend::closeFile(int fd, bool preallocated) {
+  struct stat buf {};
+
+  // Give back the preallocated blocks past the end. Truncate to the
+  // real size, bytes would extend the file with zeroes after a failed write.
+  if (preallocated && fstat(fd, &buf) == 0)
+    ftruncate(fd, buf.st_size);
+  ::close(fd);
+}
+
+void FileOutputBackend::close(void) {
+  if (fd >= 0) {
+    logStats();
+    closeFile(fd, allocated > static_cast<off_t>(bytes) && allocated != INT64_MAX);
+  }
+  if (index_fd >= 0)
+    ::close(index_fd);
+  fd = -1;
+  index_fd = -1;
+  write_failed = false;
+}
+
+FileOutputBackend::~FileOutputBackend() {
+  close();
+}
+
+bool BinaryOutputBackend::open(const std::string &path) {
+  const uint32_t header[] = {kCodecMagic, kCodecVersion};
+
+  if (!FileOutputBackend::open(path))
+    return false;
+  // The tag dictionary starts empty, so never append to an old file.
+  // The base class already seeked to its end.
+  if (ftruncate(fd, 0) < 0 || pwrite(fd, header, sizeof(header), 0) < 0 ||
+      lseek(fd, sizeof(header), SEEK_SET) < 0) {
+    PLOGE("Failed to write header of '%s'", path.c_str());
+    return false;
+  }
+  bytes = sizeof(header);
+  allocated = synced = 0;
+  // Indexed like text, at each entry the encoder starts over
+  next_index = 0;
+  return true;
+}
+
+bool BinaryOutputBackend::rotate(const std::string &path, const std::string &rotated) {
+  // The new file starts with an empty tag dictionary
+  encoder = LogEncoder();
+  return FileOutputBackend::rotate(path, rotated);
+}
+
+void BinaryOutputBackend::write(const char *data, size_t size) {
+  record.clear();
+  if (indexDue())
+    encoder.reset(record);
+  encoder.encode(std::string_view(data, size), record);
+  struct iovec iov = {record.data(), record.size()};
+  append(&iov, 1, record.size());
+}
+
+OutputContext::OutputContext(const fs::path &logDir, const std::string &filename)
+    : kFileName(filename) {
+  setBackend(logDir, OutputBackend::makeDefault());
+}
+
+OutputContext::OutputContext(const fs::path &logDir, const std::string &filename,
+                             const bool isFilter)
+    : kFileName(filename) {
+  is_filter = isFilter;
+  setBackend(logDir, OutputBackend::makeDefault(!isFilter));
+}
+
+void OutputContext::setBackend(const fs::path &logDir,
+                               std::unique_ptr<OutputBackend> newBackend) {
+  backend = std::move(newBackend);
+  dir = logDir;
+  kFilePath = (logDir / (kFileName + backend->extension())).string();
+}
+
+bool OutputContext::openOutput(void) {
+  ALOGI("%s: Opening '%s'%s", __func__, kFilePath.c_str(), is_filter ? " (filter)" : "");
+  opened = backend->open(kFilePath);
+  return opened;
+}
+
+void OutputContext::writeToOutput(const std::string &data) {
+  backend->write(data.c_str(), data.size());
+  if (stream)
+    stream->publish(data.c_str(), data.size());
+}
+
+bool OutputContext::canSplice(void) const {
+  return opened && stream == nullptr && backend->canSplice();
+}
+
+ssize_t OutputContext::spliceToOutput(int pipe_fd, size_t len) {
+  return backend->splice(pipe_fd, len);
+}
+
+void OutputContext::flush(void) {
+  if (opened)
+    backend->flush();
+}
+
+std::string OutputContext::rotate(void) {
+  if (!opened)
+    return {};
+  const auto rotated =
+      (dir / (kFileName + '.' + std::to_string(++rotations) + backend->extension())).string();
+  if (!backend->rotate(kFilePath, rotated)) {
+    rotations--;
+    return {};
+  }
+  ALOGI("%s: Rotated '%s' to '%s'", __func__, kFilePath.c_str(), rotated.c_str());
+  return rotated;
+}
+
+OutputContext::~OutputContext() {
+  if (opened && backend->empty()) {
+    ALOGD("Deleting '%s' because it is empty", kFilePath.c_str());
+    std::remove(kFilePath.c_str());
+  }
+  backend.reset();
+  opened = false;
+}
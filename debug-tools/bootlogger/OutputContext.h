@@ -0,0 +1,371 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "LogCodec.h"
+
+struct io_uring;
+struct iovec;
+struct StreamSink;
+
+/**
+ * Storage of an OutputContext's records.
+ * Each record passed is a single line without the trailing new line.
+ */
+struct OutputBackend {
+  // File extension of the backend's file, including the dot
+  virtual const char *extension() const = 0;
+
+  /**
+   * Open the backend's file.
+   *
+   * @param path absolute path of the file
+   * @return true on success
+   */
+  virtual bool open(const std::string &path) = 0;
+
+  /**
+   * Append one record.
+   *
+   * @param data record data, not new line terminated
+   * @param len length of data
+   */
+  virtual void write(const char *data, size_t len) = 0;
+
+  // Whether the file can be deleted on close as nothing was written
+  virtual bool empty() const = 0;
+
+  // Get everything written so far onto storage
+  virtual void flush() {}
+
+  /**
+   * Move the file aside and continue in a new one.
+   *
+   * @param path absolute path of the current file
+   * @param rotated path to move it to
+   * @return true on success, false if failed or not supported
+   */
+  virtual bool rotate(const std::string &path, const std::string &rotated) {
+    (void)path;
+    (void)rotated;
+    return false;
+  }
+
+  // Whether splice() is supported, false if each record has to be seen
+  virtual bool canSplice() const { return false; }
+
+  /**
+   * Move already formatted records from a pipe into the file with
+   * splice(2), so they never pass through user space.
+   *
+   * @param pipe_fd read end of a pipe
+   * @param len most bytes to move
+   * @return bytes moved, 0 if the pipe was closed, -1 on failure with errno
+   *         set, ENOTSUP if not supported
+   */
+  virtual ssize_t splice(int pipe_fd, size_t len) {
+    (void)pipe_fd;
+    (void)len;
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  /**
+   * Create the default backend of OutputContext, the plain text file.
+   * Uses io_uring if persist.ext.logdump.io_uring is true.
+   *
+   * @param primary whether this is the output of a main context. Each
+   *        io_uring backend owns a ring, so filter and demuxed outputs,
+   *        which can be many, always use plain write(2).
+   */
+  static std::unique_ptr<OutputBackend> makeDefault(bool primary = true);
+
+  virtual ~OutputBackend() = default;
+};
+
+// How hard file outputs try to get their data onto storage
+struct DurabilityPolicy {
+  enum Mode {
+    NONE,      // Leave it to the kernel's writeback
+    RANGE,     // Start writeback of new data with sync_file_range() periodically
+    DATASYNC,  // fdatasync() periodically
+    STRICT,    // fsync() after every page written
+  } mode;
+  // Period of RANGE and DATASYNC
+  std::chrono::milliseconds period;
+  // Files are preallocated in extents of this size, 0 disables
+  size_t extent;
+
+  /**
+   * Get the policy from persist.ext.logdump.durability{,_period_ms} and
+   * persist.ext.logdump.prealloc_kb
+   */
+  static const DurabilityPolicy &get(void);
+
+  /**
+   * Replace the policy for all outputs, only for logger-iobench
+   *
+   * @param policy the new policy
+   */
+  static void set(const DurabilityPolicy &policy);
+
+  /**
+   * Parse a persist.ext.logdump.durability value
+   *
+   * @param name none, range, datasync or strict
+   * @param mode set to the mode on success
+   * @return false if the name is unknown
+   */
+  static bool parseMode(const std::string &name, Mode &mode);
+};
+
+// Plain text file, new line terminated records
+struct FileOutputBackend : OutputBackend {
+  const char *extension() const override { return ".txt"; }
+  bool open(const std::string &path) override;
+  void write(const char *data, size_t len) override;
+  bool empty() const override;
+  void flush() override;
+  bool rotate(const std::string &path, const std::string &rotated) override;
+  bool canSplice() const override { return true; }
+  ssize_t splice(int pipe_fd, size_t len) override;
+  ~FileOutputBackend() override;
+
+  struct IoStats {
+    size_t syscalls;
+    size_t syncs;
+    // Longest time write() held the caller
+    std::chrono::nanoseconds max_call_latency;
+    // Longest time a write took to reach the file
+    std::chrono::nanoseconds max_io_latency;
+  };
+
+  // Statistics since the backend was created, e.g. for logger-iobench
+  IoStats getIoStats(void) const {
+    return {nr_syscalls, nr_syncs, max_call_latency, max_io_latency};
+  }
+
+ protected:
+  // Close the file and its index, giving back the preallocated blocks
+  void close(void);
+
+  /**
+   * Close a file, truncating it to its real size first if blocks were
+   * preallocated past its end.
+   */
+  static void closeFile(int fd, bool preallocated);
+
+  // Log the statistics of the current file
+  void logStats(void) const;
+
+  /**
+   * Rename a closed file and its index, and reset the counters for a new file.
+   *
+   * @return false if the file could not be renamed
+   */
+  bool renameClosed(const std::string &path, const std::string &rotated);
+
+  // fallocate() an extent if size more bytes do not fit, see preallocate()
+  void reserve(size_t size);
+
+  // Sync the file if due by the durability policy
+  void sync(void);
+
+  /**
+   * Account a record of size bytes (including new line) about to be
+   * appended, adding a sidecar index entry if an interval has passed.
+   */
+  void account(size_t size);
+
+  // Whether the next record gets a sidecar index entry
+  bool indexDue(void) const;
+
+  /**
+   * Append one record of size bytes with writev(), applying the
+   * durability policy.
+   */
+  void append(const struct iovec *iov, int iovcnt, size_t size);
+
+  // Preallocate an extent if size more bytes do not fit
+  // @return the fallocate() range to use, or {0, 0} if not needed
+  std::pair<off_t, off_t> preallocate(size_t size);
+
+  // Whether a sync is due by the durability policy, dirty is unsynced bytes
+  bool syncDue(size_t dirty);
+
+  int fd = -1;
+  // A write failed, only logged once
+  bool write_failed = false;
+  // Unsynced bytes
+  size_t len = 0;
+  // Durability
+  off_t allocated = 0;
+  uint64_t synced = 0;
+  std::chrono::steady_clock::time_point last_sync{};
+  size_t nr_syncs = 0;
+  // Sidecar index
+  std::string index_path;
+  int index_fd = -1;
+  uint64_t bytes = 0;
+  uint64_t lines = 0;
+  uint64_t next_index = 0;
+  // Statistics, logged on close
+  size_t nr_syscalls = 0;
+  std::chrono::nanoseconds max_call_latency{};
+  std::chrono::nanoseconds max_io_latency{};
+};
+
+/**
+ * Binary file in the LogCodec format, see LogCodec.h.
+ * Indexed like text, the encoder writes a RESET record and starts over at
+ * each index entry so decoding can start there.
+ */
+struct BinaryOutputBackend : FileOutputBackend {
+  const char *extension() const override { return ".blog"; }
+  bool open(const std::string &path) override;
+  void write(const char *data, size_t len) override;
+  bool empty() const override { return lines == 0; }
+  bool rotate(const std::string &path, const std::string &rotated) override;
+  // Records have to be encoded one by one
+  bool canSplice() const override { return false; }
+
+ private:
+  LogEncoder encoder;
+  std::string record;
+};
+
+/**
+ * Plain text file written through io_uring.
+ * Records are batched into buffers, which are submitted asynchronously
+ * together with the fsyncs, so the caller never waits for flash I/O unless
+ * every buffer is still in flight. Rotation does not wait either, the old
+ * file is synced and closed once its writes completed. Falls back to
+ * FileOutputBackend's plain write(2) path if io_uring is unavailable.
+ */
+struct UringOutputBackend : FileOutputBackend {
+  UringOutputBackend();
+  bool open(const std::string &path) override;
+  void write(const char *data, size_t len) override;
+  bool empty() const override;
+  void flush() override;
+  bool rotate(const std::string &path, const std::string &rotated) override;
+  ssize_t splice(int pipe_fd, size_t len) override;
+  ~UringOutputBackend() override;
+
+ private:
+  static constexpr size_t kNumBuffers = 8;
+  static constexpr size_t kBufferSize = 64 * 1024;
+
+  // user_data of requests without a buffer
+  static constexpr uint64_t kNoBuffer = UINT64_MAX;
+  // user_data of the last request on a rotated file
+  static constexpr uint64_t kRetire = UINT64_MAX - 1;
+
+  struct Buffer {
+    std::vector<char> data;
+    bool inflight = false;
+    std::chrono::steady_clock::time_point submitted{};
+  };
+
+  // Reap finished requests, waiting for at least one if wait is true
+  void reap(bool wait);
+  // Submit the current buffer and wait for everything in flight
+  void drain(void);
+  // Submit the current buffer and move to a free one
+  void submit(void);
+
+  std::unique_ptr<struct io_uring> ring;
+  std::array<Buffer, kNumBuffers> buffers;
+  size_t current = 0;
+  off_t offset = 0;
+  size_t pending = 0;
+  // Rotated file whose writes are still in flight
+  int retired_fd = -1;
+  bool retired_preallocated = false;
+};
+
+// Base context for outputs with file
+struct OutputContext {
+  // File path (absolute)  of this context.
+  // Note that the backend's extension is auto appended.
+  std::string kFilePath;
+  // Just the filename only
+  std::string kFileName;
+
+  // Takes one argument 'filename' without file extension
+  OutputContext(const std::filesystem::path &logDir, const std::string &filename);
+
+  // Takes two arguments 'filename' and is_filter
+  OutputContext(const std::filesystem::path &logDir, const std::string &filename,
+                const bool isFilter);
+
+  // No default constructor
+  OutputContext() = delete;
+
+  /**
+   * Replace the storage backend, must be called before openOutput().
+   *
+   * @param logDir directory to place the backend's file in
+   * @param backend the backend to use
+   */
+  void setBackend(const std::filesystem::path &logDir,
+                  std::unique_ptr<OutputBackend> backend);
+
+  /**
+   * Open the output backend.
+   */
+  bool openOutput(void);
+
+  /**
+   * Writes the string to this context's file
+   *
+   * @param string data
+   */
+  void writeToOutput(const std::string &data);
+
+  // Get everything written so far onto storage
+  void flush(void);
+
+  // Also stream the records written to this sink, see StreamServer
+  void setStream(StreamSink *sink) { stream = sink; }
+
+  // Whether spliceToOutput() may be used: the backend supports it, and
+  // nothing else needs to see the records
+  bool canSplice(void) const;
+
+  /**
+   * Move formatted records from a pipe into the output, see
+   * OutputBackend::splice()
+   */
+  ssize_t spliceToOutput(int pipe_fd, size_t len);
+
+  /**
+   * Move the file aside as <filename>.<N><extension> and continue in a new one
+   *
+   * @return the rotated path, or empty if failed or not supported
+   */
+  std::string rotate(void);
+
+  operator bool() const { return opened; }
+
+  /**
+   * Cleanup
+   */
+  ~OutputContext();
+
+ private:
+  std::unique_ptr<OutputBackend> backend;
+  bool opened = false;
+  bool is_filter = false;
+  unsigned rotations = 0;
+  std::filesystem::path dir;
+  StreamSink *stream = nullptr;
+};
@@ -0,0 +1,82 @@
+#include "RateLimiter.h"
+
+#include <time.h>
+
+#include <algorithm>
+
+static int64_t nowNs(void) {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// FNV-1a with a per-row seed
+static uint64_t hashOf(std::string_view str, uint64_t seed) {
+  uint64_t hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+  for (const unsigned char c : str) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+RateLimiter::RateLimiter(double rate, double burst)
+    : rate(rate), burst(burst), last_report(std::chrono::steady_clock::now()) {
+  const int64_t now = nowNs();
+  for (auto &row : buckets)
+    row.fill({static_cast<float>(burst), now});
+}
+
+bool RateLimiter::allow(std::string_view key) {
+  const int64_t now = nowNs();
+  std::array<Bucket *, kDepth> cells;
+  float best = 0;
+
+  for (size_t i = 0; i < kDepth; ++i) {
+    Bucket *b = &buckets[i][hashOf(key, i) % kWidth];
+    b->tokens = std::min<double>(burst, b->tokens + (now - b->last_ns) * rate / 1e9);
+    b->last_ns = now;
+    best = std::max(best, b->tokens);
+    cells[i] = b;
+  }
+  if (best >= 1) {
+    for (auto *b : cells)
+      b->tokens = std::max(0.0f, b->tokens - 1);
+    return true;
+  }
+
+  dropped.fetch_add(1, std::memory_order_relaxed);
+  interval_dropped++;
+  auto it = std::find_if(drops.begin(), drops.begin() + nr_drops,
+                         [key](const DropEntry &e) { return e.key == key; });
+  if (it != drops.begin() + nr_drops)
+    it->count++;
+  else if (nr_drops < kMaxReportKeys)
+    drops[nr_drops++] = {std::string(key), 1};
+  else
+    others++;
+  return false;
+}
+
+void RateLimiter::report(const std::function<void(const std::string &)> &write, bool force) {
+  const auto now = std::chrono::steady_clock::now();
+
+  if (interval_dropped == 0 || (!force && now - last_report < kReportInterval))
+    return;
+  std::string line = "--------- rate limit: dropped " + std::to_string(interval_dropped) +
+                     " records in " +
+                     std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                                        now - last_report).count()) + "s (";
+  for (size_t i = 0; i < nr_drops; ++i) {
+    line += (i ? ", " : "") + drops[i].key + ": " + std::to_string(drops[i].count);
+  }
+  if (others > 0)
+    line += ", others: " + std::to_string(others);
+  line += ')';
+  write(line);
+
+  nr_drops = 0;
+  others = 0;
+  interval_dropped = 0;
+  last_report = now;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * Per-key token bucket rate limiter, in constant memory.
+ *
+ * The buckets live in a count-min sketch: each key maps to one bucket in
+ * each of kDepth rows, and is allowed while any of them still has a token.
+ * A heavy key drains all of its buckets, while a light key sharing a
+ * bucket with it still passes through the others.
+ * Not thread safe, each LoggerContext owns one. Counters are atomic so
+ * they can be read from other threads.
+ */
+struct RateLimiter {
+  /**
+   * @param rate tokens refilled per second
+   * @param burst bucket capacity
+   */
+  RateLimiter(double rate, double burst);
+
+  /**
+   * Consume a token of key
+   *
+   * @param key tag or priority of the record
+   * @return true if the record may be written
+   */
+  bool allow(std::string_view key);
+
+  /**
+   * Report the drops since the last report, at most every kReportInterval
+   *
+   * @param write invoked with the report record
+   * @param force report even if the interval has not passed
+   */
+  void report(const std::function<void(const std::string &)> &write, bool force = false);
+
+  // Records dropped so far
+  uint64_t getDropped(void) const { return dropped; }
+
+ private:
+  static constexpr size_t kDepth = 4;
+  static constexpr size_t kWidth = 1024;
+  static constexpr size_t kMaxReportKeys = 16;
+  static constexpr auto kReportInterval = std::chrono::seconds(10);
+
+  struct Bucket {
+    float tokens;
+    int64_t last_ns;
+  };
+  struct DropEntry {
+    std::string key;
+    uint64_t count;
+  };
+
+  double rate, burst;
+  std::array<std::array<Bucket, kWidth>, kDepth> buckets;
+  // Keys dropped since last report, the rest is counted in 'others'
+  std::array<DropEntry, kMaxReportKeys> drops;
+  size_t nr_drops = 0;
+  uint64_t others = 0;
+  uint64_t interval_dropped = 0;
+  std::chrono::steady_clock::time_point last_report;
+  std::atomic_uint64_t dropped = 0;
+};
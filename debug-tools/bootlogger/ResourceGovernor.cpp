@@ -0,0 +1,235 @@
+#include "ResourceGovernor.h"
+
+#include <android-base/file.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <dirent.h>
+#include <linux/ioprio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <unordered_map>
+
+#include "LoggerInternal.h"
+
+using android::base::GetIntProperty;
+using android::base::GetProperty;
+using android::base::ReadFileToString;
+using android::base::Split;
+using android::base::WriteStringToFile;
+
+#define SCHED_PROP(prop) "persist.ext.logdump.sched." prop
+
+/**
+ * Parse an I/O priority, "none", "idle" or "be[:level]"
+ *
+ * @return the ioprio_set() value, -1 for none
+ */
+static int parseIoprio(const std::string &str) {
+  if (str == "idle")
+    return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+  if (str.rfind("be", 0) == 0) {
+    int level = 4;
+    if (str.size() > 3 && str[2] == ':')
+      level = std::atoi(str.c_str() + 3);
+    if (level >= 0 && level <= 7)
+      return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, level);
+  }
+  if (str != "none")
+    ALOGW("Invalid I/O priority '%s', leaving it as is", str.c_str());
+  return -1;
+}
+
+/**
+ * Parse a CPU list, e.g. "0-3,6"
+ *
+ * @return true if any CPU was set
+ */
+static bool parseCpus(const std::string &str, cpu_set_t &set) {
+  bool any = false;
+
+  CPU_ZERO(&set);
+  for (const auto &range : Split(str, ",")) {
+    char *end = nullptr;
+    const unsigned long first = std::strtoul(range.c_str(), &end, 10);
+    unsigned long last = first;
+    if (end == range.c_str()) {
+      if (!range.empty())
+        ALOGW("Invalid CPU list '%s'", str.c_str());
+      continue;
+    }
+    if (*end == '-')
+      last = std::strtoul(end + 1, nullptr, 10);
+    for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, &set);
+      any = true;
+    }
+  }
+  return any;
+}
+
+ResourceGovernor::ResourceGovernor(void) {
+  has_cpus = parseCpus(GetProperty(SCHED_PROP("cpus"), ""), cpus);
+  cgroup = GetProperty(SCHED_PROP("cgroup"), "");
+  capture.nice = GetIntProperty(SCHED_PROP("capture_nice"), 0, -20, 19);
+  capture.ioprio = parseIoprio(GetProperty(SCHED_PROP("capture_io"), "none"));
+  background.idle = GetProperty(SCHED_PROP("policy"), "nice") == "idle";
+  background.nice = GetIntProperty(SCHED_PROP("nice"), 10, -20, 19);
+  background.ioprio = parseIoprio(GetProperty(SCHED_PROP("io"), "be:7"));
+}
+
+const ResourceGovernor &ResourceGovernor::get(void) {
+  static const ResourceGovernor kGovernor;
+  return kGovernor;
+}
+
+void ResourceGovernor::applyProcess(void) const {
+  if (has_cpus) {
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+      PLOGE("Failed to set CPU affinity");
+    else
+      ALOGI("Running on %d CPUs", CPU_COUNT(&cpus));
+  }
+  // Moves every thread, with cgroup v1 and v2 alike
+  if (!cgroup.empty()) {
+    if (!WriteStringToFile(std::to_string(getpid()), cgroup + "/cgroup.procs"))
+      PLOGE("Failed to join cgroup '%s'", cgroup.c_str());
+    else
+      ALOGI("Joined cgroup '%s'", cgroup.c_str());
+  }
+}
+
+void ResourceGovernor::applyThread(Role role) const {
+  const auto &settings = role == CAPTURE ? capture : background;
+  const struct sched_param param {};
+  const pid_t tid = gettid();
+
+  // Threads inherit these from their creator, so always set both
+  if (sched_setscheduler(0, settings.idle ? SCHED_IDLE : SCHED_OTHER, &param) < 0)
+    PLOGE("Failed to set scheduling policy of thread %d", tid);
+  if (setpriority(PRIO_PROCESS, tid, settings.nice) < 0)
+    PLOGE("Failed to set nice of thread %d", tid);
+  if (settings.ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, settings.ioprio) < 0)
+    PLOGE("Failed to set I/O priority of thread %d", tid);
+}
+
+/**
+ * Find the value of a "key value" or "key: value" line
+ *
+ * @return the value, 0 if not found
+ */
+static uint64_t findValue(const std::string &text, const std::string &key) {
+  size_t pos = 0;
+  while ((pos = text.find(key, pos)) != std::string::npos) {
+    const bool start = pos == 0 || text[pos - 1] == '\n';
+    pos += key.size();
+    if (start && pos < text.size() && (text[pos] == ' ' || text[pos] == ':'))
+      return std::strtoull(text.c_str() + pos + 1, nullptr, 10);
+  }
+  return 0;
+}
+
+static std::string percentOf(uint64_t part, uint64_t total) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%.2f%%", total ? 100.0 * part / total : 0.0);
+  return buf;
+}
+
+/**
+ * Read the CPU time and parent of a process from its stat file
+ *
+ * @param path /proc/<pid>/stat
+ * @param ticks utime + stime, plus cutime + cstime of its reaped children
+ * @param ppid the parent pid
+ * @return false if the process is gone
+ */
+static bool readStat(const std::string &path, uint64_t &ticks, pid_t &ppid) {
+  std::string text, field;
+
+  if (!ReadFileToString(path, &text) || text.rfind(')') == std::string::npos)
+    return false;
+  // Fields start at 3 after the command, which may contain spaces
+  std::istringstream ss(text.substr(text.rfind(')') + 2));
+  ticks = 0;
+  ppid = 0;
+  for (int i = 3; i <= 17 && ss >> field; ++i) {
+    if (i == 4)
+      ppid = std::strtol(field.c_str(), nullptr, 10);
+    else if (i >= 14)
+      ticks += std::strtoull(field.c_str(), nullptr, 10);
+  }
+  return true;
+}
+
+// The processes started by the logger and their descendants, e.g. logcat
+static std::vector<pid_t> getDescendants(void) {
+  std::unordered_map<pid_t, std::vector<pid_t>> children;
+  std::vector<pid_t> out;
+  uint64_t ticks;
+  pid_t ppid;
+
+  DIR *dir = opendir("/proc");
+  if (dir == nullptr)
+    return out;
+  while (auto *entry = readdir(dir)) {
+    const pid_t pid = std::strtol(entry->d_name, nullptr, 10);
+    if (pid > 0 && readStat(std::string("/proc/") + entry->d_name + "/stat", ticks, ppid))
+      children[ppid].emplace_back(pid);
+  }
+  closedir(dir);
+  out.emplace_back(getpid());
+  for (size_t i = 0; i < out.size(); ++i) {
+    const auto it = children.find(out[i]);
+    if (it != children.end())
+      out.insert(out.end(), it->second.begin(), it->second.end());
+  }
+  out.erase(out.begin());
+  return out;
+}
+
+void ResourceGovernor::getStats(std::vector<std::string> &out) {
+  const auto descendants = getDescendants();
+  std::string text;
+  uint64_t ticks;
+  pid_t ppid;
+
+  // Including the children still running, which popen() hides from us
+  uint64_t self = 0;
+  if (readStat("/proc/self/stat", ticks, ppid))
+    self = ticks;
+  for (const auto pid : descendants) {
+    if (readStat("/proc/" + std::to_string(pid) + "/stat", ticks, ppid))
+      self += ticks;
+  }
+  // user nice system idle iowait irq softirq steal, guest time is in user
+  uint64_t busy = 0;
+  if (ReadFileToString("/proc/stat", &text)) {
+    std::istringstream ss(text.substr(0, text.find('\n')));
+    std::string field;
+    ss >> field;
+    for (int i = 0; i < 8 && ss >> field; ++i) {
+      if (i != 3 && i != 4)
+        busy += std::strtoull(field.c_str(), nullptr, 10);
+    }
+  }
+  const long hz = sysconf(_SC_CLK_TCK);
+  out.emplace_back("sched: " + std::to_string(self * 1000 / (hz > 0 ? hz : 100)) + "ms CPU, " +
+                   percentOf(self, busy) + " of busy CPU time since boot, " +
+                   std::to_string(descendants.size()) + " child processes");
+
+  // pgpgout is in KiB
+  uint64_t written = 0, total = 0;
+  if (ReadFileToString("/proc/self/io", &text))
+    written = findValue(text, "write_bytes");
+  for (const auto pid : descendants) {
+    if (ReadFileToString("/proc/" + std::to_string(pid) + "/io", &text))
+      written += findValue(text, "write_bytes");
+  }
+  if (ReadFileToString("/proc/vmstat", &text))
+    total = findValue(text, "pgpgout") << 10;
+  out.emplace_back("sched: " + std::to_string(written) + " bytes written, " +
+                   percentOf(written, total) + " of disk writes since boot");
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sched.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Keeps the logger from competing with the boot it observes.
+ *
+ * Capture threads keep their CPU priority, so the sources are read before
+ * they overflow. Everything else (AVC parsing, the servers, the final
+ * outputs) is niced or SCHED_IDLE. Each role has its own I/O priority,
+ * note that capture threads also write the outputs.
+ * Configured by the persist.ext.logdump.sched.* properties. The sepolicy
+ * only lets the logger join /sys/fs/cgroup/logger, which init creates.
+ */
+struct ResourceGovernor {
+  enum Role {
+    CAPTURE,     // Reads a source, and writes its outputs
+    BACKGROUND,  // Everything else
+  };
+
+  // Get the governor, configured from properties on first use
+  static const ResourceGovernor &get(void);
+
+  /**
+   * Apply the process wide settings, CPU affinity and cgroup.
+   * Call before any thread is created, so they inherit the affinity.
+   */
+  void applyProcess(void) const;
+
+  /**
+   * Apply the settings of a role to the calling thread
+   *
+   * @param role what the thread does
+   */
+  void applyThread(Role role) const;
+
+  /**
+   * Append the logger's share of CPU time and disk writes since boot,
+   * including its child processes like logcat
+   *
+   * @param out buffer to append lines to
+   */
+  static void getStats(std::vector<std::string> &out);
+
+ private:
+  struct ThreadSettings {
+    bool idle;     // SCHED_IDLE instead of SCHED_OTHER
+    int nice;
+    int ioprio;    // ioprio_set() value, -1 to leave as is
+  };
+
+  ResourceGovernor(void);
+
+  cpu_set_t cpus;
+  bool has_cpus = false;
+  std::string cgroup;
+  ThreadSettings capture{}, background{};
+};
@@ -0,0 +1,220 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "LoggerInternal.h"
+#include "RingBuffer.h"
+
+bool RingBufferBackend::open(const std::string &path) {
+  struct stat statbuf {};
+
+  // Keep the previous ring around, it is what survived the reboot/crash
+  if (stat(path.c_str(), &statbuf) == 0) {
+    const std::string old = path + ".old";
+    if (rename(path.c_str(), old.c_str()) < 0)
+      PLOGE("Failed to rename '%s' to '%s'", path.c_str(), old.c_str());
+  }
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", path.c_str());
+    return false;
+  }
+  // First page is the header, rest is data. Round everything to pages.
+  map_size = BUF_SIZE + ((data_size + BUF_SIZE - 1) / BUF_SIZE) * BUF_SIZE;
+  // Allocate all blocks now, so no write can hit ENOSPC/SIGBUS later
+  if (fallocate(fd, 0, 0, map_size) < 0 && ftruncate(fd, map_size) < 0) {
+    PLOGE("Failed to allocate %zu bytes for '%s'", map_size, path.c_str());
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  auto addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    PLOGE("mmap");
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  header = static_cast<RingHeader *>(addr);
+  data = static_cast<char *>(addr) + BUF_SIZE;
+  header->version = kRingVersion;
+  header->data_offset = BUF_SIZE;
+  header->data_size = map_size - BUF_SIZE;
+  header->write_offset = 0;
+  header->wrap_count = 0;
+  header->sequence = 0;
+  // Magic last, so a half-initialized header is never valid
+  __atomic_store_n(&header->magic, kRingMagic, __ATOMIC_RELEASE);
+  data_size = header->data_size;
+  return true;
+}
+
+void RingBufferBackend::write(const char *buf, size_t len) {
+  // A record larger than half of the ring would evict everything else
+  len = std::min(len, data_size / 2 - sizeof(RingRecord));
+
+  const size_t need = RingAlign(sizeof(RingRecord) + len);
+  uint64_t pos = header->write_offset;
+  const uint64_t seq = header->sequence;
+
+  if (pos + need > data_size) {
+    if (data_size - pos >= sizeof(RingRecord)) {
+      auto pad = reinterpret_cast<RingRecord *>(data + pos);
+      __atomic_store_n(&pad->magic, 0, __ATOMIC_RELEASE);
+      pad->length = kRingPadLength;
+      pad->sequence = seq;
+      __atomic_store_n(&pad->magic, kRingRecordMagic, __ATOMIC_RELEASE);
+    }
+    pos = 0;
+    __atomic_store_n(&header->wrap_count, header->wrap_count + 1, __ATOMIC_RELEASE);
+  }
+  auto rec = reinterpret_cast<RingRecord *>(data + pos);
+  // Retire the old record here first, a crash during the copy must not
+  // leave its valid header in front of a half-written payload
+  __atomic_store_n(&rec->magic, 0, __ATOMIC_RELEASE);
+  memcpy(data + pos + sizeof(RingRecord), buf, len);
+  rec->length = len;
+  rec->sequence = seq;
+  __atomic_store_n(&rec->magic, kRingRecordMagic, __ATOMIC_RELEASE);
+
+  // Publish. No msync() here, dirty pages of a shared mapping are written
+  // back by the kernel on its own and survive the process crashing.
+  __atomic_store_n(&header->write_offset, pos + need, __ATOMIC_RELEASE);
+  __atomic_store_n(&header->sequence, seq + 1, __ATOMIC_RELEASE);
+}
+
+void RingBufferBackend::flush() {
+  if (header != nullptr)
+    msync(header, map_size, MS_SYNC);
+}
+
+RingBufferBackend::~RingBufferBackend() {
+  if (header != nullptr) {
+    msync(header, map_size, MS_ASYNC);
+    munmap(header, map_size);
+  }
+  if (fd >= 0)
+    close(fd);
+  header = nullptr;
+  data = nullptr;
+  fd = -1;
+}
+
+namespace {
+
+struct RingView {
+  const char *data;
+  size_t size;
+
+  // Returns the record at offset if it looks sane, else nullptr
+  const RingRecord *at(size_t off) const {
+    if (off + sizeof(RingRecord) > size)
+      return nullptr;
+    auto rec = reinterpret_cast<const RingRecord *>(data + off);
+    if (rec->magic != kRingRecordMagic)
+      return nullptr;
+    if (rec->length != kRingPadLength &&
+        off + RingAlign(sizeof(RingRecord) + rec->length) > size)
+      return nullptr;
+    return rec;
+  }
+
+  /**
+   * Follow the chain of records starting at off, as long as sequence
+   * numbers are consecutive.
+   *
+   * @return true if the chain ended on a pad record or at the end of data
+   */
+  bool walk(size_t off, std::vector<size_t> &out, size_t &end) const {
+    const RingRecord *rec, *prev = nullptr;
+    while ((rec = at(off)) != nullptr) {
+      if (prev && rec->sequence != prev->sequence + 1)
+        break;
+      if (rec->length == kRingPadLength) {
+        end = off;
+        return true;
+      }
+      out.emplace_back(off);
+      prev = rec;
+      off += RingAlign(sizeof(RingRecord) + rec->length);
+    }
+    end = off;
+    return off + sizeof(RingRecord) > size;
+  }
+};
+
+}  // namespace
+
+bool ReadRingBuffer(const std::string &path,
+                    const std::function<void(uint64_t, const char *, size_t)> &callback) {
+  struct stat statbuf {};
+  std::vector<size_t> newer, older;
+  size_t end = 0;
+  bool ret = false;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", path.c_str());
+    return false;
+  }
+  if (fstat(fd, &statbuf) < 0 || statbuf.st_size < static_cast<off_t>(sizeof(RingHeader))) {
+    ALOGE("'%s' is too small to be a ring file", path.c_str());
+    close(fd);
+    return false;
+  }
+  auto addr = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    PLOGE("mmap");
+    return false;
+  }
+  auto header = static_cast<const RingHeader *>(addr);
+  if (header->magic != kRingMagic || header->version != kRingVersion ||
+      header->data_offset + header->data_size > static_cast<uint64_t>(statbuf.st_size)) {
+    ALOGE("'%s' has an invalid ring header", path.c_str());
+    goto out;
+  }
+  {
+    RingView view{static_cast<const char *>(addr) + header->data_offset,
+                  static_cast<size_t>(header->data_size)};
+
+    // The newest lap always starts at data offset 0. Records found past
+    // header->write_offset are still accepted, the header might not have
+    // been published before a crash.
+    view.walk(0, newer, end);
+
+    // Some records of the previous lap remain after the newest lap,
+    // the first few are usually partially overwritten. Find the first
+    // intact one, whose chain runs until the wrap point.
+    if (header->wrap_count > 0) {
+      const uint64_t first = newer.empty() ? header->sequence : view.at(newer.front())->sequence;
+      for (size_t off = RingAlign(end); off < view.size; off += kRingAlign) {
+        auto rec = view.at(off);
+        if (rec == nullptr || rec->length == kRingPadLength || rec->sequence >= first)
+          continue;
+        std::vector<size_t> chain;
+        size_t chain_end;
+        if (view.walk(off, chain, chain_end)) {
+          older = std::move(chain);
+          break;
+        }
+      }
+    }
+    for (const auto *vec : {&older, &newer}) {
+      for (const auto off : *vec) {
+        auto rec = view.at(off);
+        callback(rec->sequence, view.data + off + sizeof(RingRecord), rec->length);
+      }
+    }
+    ret = true;
+  }
+out:
+  munmap(addr, statbuf.st_size);
+  return ret;
+}
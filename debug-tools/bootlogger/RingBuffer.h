@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "OutputContext.h"
+
+/**
+ * On-disk layout of the memory-mapped ring file.
+ *
+ * The first page holds a RingHeader, the rest is the data region.
+ * Records are 8-byte aligned, each starting with a RingRecord header
+ * followed by the payload. A record never wraps around the end of the
+ * data region: a padding record is written instead and the writer
+ * restarts at data offset 0, incrementing wrap_count.
+ */
+static constexpr uint32_t kRingMagic = 0x4252474c;        // "LGRB"
+static constexpr uint32_t kRingRecordMagic = 0x4345524c;  // "LREC"
+static constexpr uint32_t kRingVersion = 1;
+static constexpr uint32_t kRingPadLength = UINT32_MAX;
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t data_offset;   // Offset of data region in file
+  uint64_t data_size;     // Size of data region
+  uint64_t write_offset;  // Next record position in data region
+  uint64_t wrap_count;    // How many times the writer wrapped
+  uint64_t sequence;      // Sequence number of the next record
+};
+
+struct RingRecord {
+  uint32_t magic;
+  uint32_t length;        // Payload length, or kRingPadLength
+  uint64_t sequence;
+};
+
+static constexpr size_t kRingAlign = 8;
+
+static inline size_t RingAlign(size_t len) {
+  return (len + kRingAlign - 1) & ~(kRingAlign - 1);
+}
+
+// Fixed-size, preallocated memory-mapped ring file
+struct RingBufferBackend : OutputBackend {
+  // @param size size of the data region in bytes
+  explicit RingBufferBackend(size_t size) : data_size(size) {}
+
+  const char *extension() const override { return ".ring"; }
+  bool open(const std::string &path) override;
+  void write(const char *data, size_t len) override;
+  // Never delete the ring, it is preallocated anyway
+  bool empty() const override { return false; }
+  void flush() override;
+  ~RingBufferBackend() override;
+
+ private:
+  size_t data_size;
+  size_t map_size = 0;
+  int fd = -1;
+  RingHeader *header = nullptr;
+  char *data = nullptr;
+  size_t written = 0;
+};
+
+/**
+ * Rebuild the logical order of a ring file's records
+ *
+ * @param path path to the ring file
+ * @param callback invoked for each record, oldest first
+ * @return true on success
+ */
+bool ReadRingBuffer(const std::string &path,
+                    const std::function<void(uint64_t seq, const char *data, size_t len)> &callback);
@@ -0,0 +1,21 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "LoggerInternal.h"
+#include "RingBuffer.h"
+
+int main(int argc, const char **argv) {
+  bool ret = true;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [ring file]...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i < argc; ++i) {
+    ret &= ReadRingBuffer(argv[i], [](uint64_t, const char *data, size_t len) {
+      fwrite(data, 1, len, stdout);
+      fputc('\n', stdout);
+    });
+  }
+  return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
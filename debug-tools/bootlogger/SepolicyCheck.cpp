@@ -0,0 +1,113 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LoggerInternal.h"
+#include "SepolicyIndex.h"
+
+namespace {
+
+void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-n CIL]... POLICY [AVC_LOG]\n", argv0);
+  fprintf(stderr, "           -n: read the neverallows of a CIL file, may be repeated\n");
+  fprintf(stderr, "       POLICY is a binary policy, e.g. %s\n", kKernelPolicyPath);
+  fprintf(stderr, "       AVC_LOG holds avc: lines, e.g. dmesg or logcat, "
+                  "defaults to stdin\n");
+  fprintf(stderr, "       Exits with 2 if a rule conflicts with a neverallow\n");
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> cils;
+  SepolicyIndex policy;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        cils.emplace_back(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc || argc - optind > 2) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const auto loadStart = std::chrono::steady_clock::now();
+  if (!policy.load(argv[optind])) {
+    fprintf(stderr, "Failed to load '%s'\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  for (const auto &cil : cils) {
+    if (policy.loadNeverallows(cil) < 0) {
+      fprintf(stderr, "Failed to read '%s'\n", cil.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  const auto loadEnd = std::chrono::steady_clock::now();
+
+  std::ifstream file;
+  if (argc - optind == 2) {
+    file.open(argv[optind + 1]);
+    if (!file) {
+      fprintf(stderr, "Failed to open '%s'\n", argv[optind + 1]);
+      return EXIT_FAILURE;
+    }
+  }
+  std::istream &in = file.is_open() ? file : std::cin;
+
+  // Merged like the logger does, one rule per source, target and class
+  AvcContexts ctxs;
+  std::unordered_map<std::string, size_t> index;
+  std::string line;
+  while (std::getline(in, line)) {
+    const size_t before = ctxs.size();
+    if (!parseOneAvcContext(line, ctxs))
+      continue;
+    auto &ctx = ctxs.back();
+    auto key = std::to_string(ctx.granted) + ' ' + ctx.scontext + ' ' + ctx.tcontext + ' ' +
+               ctx.tclass;
+    auto [it, inserted] = index.try_emplace(std::move(key), before);
+    if (!inserted) {
+      ctxs[it->second] += ctx;
+      ctxs.pop_back();
+    }
+  }
+
+  size_t counts[SepolicyIndex::UNKNOWN + 1] = {};
+  std::vector<SepolicyIndex::Verdict> verdicts;
+  const auto checkStart = std::chrono::steady_clock::now();
+  for (const auto &ctx : ctxs) {
+    verdicts.emplace_back(policy.check(ctx));
+    ++counts[verdicts.back()];
+  }
+  const auto checkEnd = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < ctxs.size(); ++i) {
+    std::vector<std::string> rule;
+    writeAllowRules({ctxs[i]}, rule);
+    if (!rule.empty())
+      printf("%s: %s\n", SepolicyIndex::verdictName(verdicts[i]), rule.front().c_str());
+  }
+
+  using ms = std::chrono::duration<double, std::milli>;
+  fprintf(stderr, "loaded %zu allow rules and %zu neverallows in %.1f ms\n", policy.getRules(),
+          policy.getNeverallows(), ms(loadEnd - loadStart).count());
+  fprintf(stderr, "checked %zu rules in %.3f ms: %zu allowed, %zu new, %zu neverallow, "
+                  "%zu unknown\n", ctxs.size(), ms(checkEnd - checkStart).count(),
+          counts[SepolicyIndex::ALLOWED], counts[SepolicyIndex::NEW],
+          counts[SepolicyIndex::NEVERALLOW], counts[SepolicyIndex::UNKNOWN]);
+  return counts[SepolicyIndex::NEVERALLOW] > 0 ? 2 : EXIT_SUCCESS;
+}
@@ -0,0 +1,734 @@
+#include "SepolicyIndex.h"
+
+#include <android-base/file.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <string_view>
+
+using android::base::ReadFileToString;
+
+namespace {
+
+constexpr uint32_t kPolicyMagic = 0xf97cff8c;
+constexpr char kPolicyString[] = "SE Linux";
+
+// Policy versions changing the format, see security/selinux/ss/policydb.h
+enum : uint32_t {
+  kVersionMls = 19,
+  kVersionAvtab = 20,  // Oldest supported
+  kVersionRangeTrans = 21,
+  kVersionPolcap = 22,
+  kVersionPermissive = 23,
+  kVersionBoundary = 24,
+  kVersionFilenameTrans = 25,
+  kVersionRoleTrans = 26,
+  kVersionObjectDefaults = 27,
+  kVersionDefaultType = 28,
+  kVersionConstraintNames = 29,
+  kVersionCompFilenameTrans = 33,
+  kVersionMax = 34,
+};
+
+enum { SYM_COMMONS, SYM_CLASSES, SYM_ROLES, SYM_TYPES, SYM_USERS, SYM_BOOLS, SYM_LEVELS, SYM_CATS };
+enum {
+  OCON_ISID,
+  OCON_FS,
+  OCON_PORT,
+  OCON_NETIF,
+  OCON_NODE,
+  OCON_FSUSE,
+  OCON_NODE6,
+  OCON_IBPKEY,
+  OCON_IBENDPORT,
+};
+
+constexpr uint16_t kAvtabAllowed = 0x0001;
+constexpr uint16_t kAvtabXperms = 0x0700;
+constexpr uint32_t kTypeAttribute = 0x2;
+constexpr uint32_t kCexprNames = 5;
+
+// Little endian reader of the policy image, failing for good on overrun
+struct Reader {
+  const uint8_t *pos, *end;
+  bool ok = true;
+
+  bool need(size_t n) {
+    ok = ok && static_cast<size_t>(end - pos) >= n;
+    return ok;
+  }
+  uint32_t u32() {
+    uint32_t v = 0;
+    if (need(sizeof(v))) {
+      memcpy(&v, pos, sizeof(v));
+      pos += sizeof(v);
+    }
+    return le32toh(v);
+  }
+  uint16_t u16() {
+    uint16_t v = 0;
+    if (need(sizeof(v))) {
+      memcpy(&v, pos, sizeof(v));
+      pos += sizeof(v);
+    }
+    return le16toh(v);
+  }
+  uint64_t u64() {
+    uint64_t v = 0;
+    if (need(sizeof(v))) {
+      memcpy(&v, pos, sizeof(v));
+      pos += sizeof(v);
+    }
+    return le64toh(v);
+  }
+  void skip(size_t n) {
+    if (need(n))
+      pos += n;
+  }
+  std::string str(size_t n) {
+    if (!need(n))
+      return {};
+    std::string s(reinterpret_cast<const char *>(pos), n);
+    pos += n;
+    return s;
+  }
+  // Element count, each at least min bytes, so a corrupt one fails early
+  uint32_t count(size_t min) {
+    const uint32_t n = u32();
+    ok = ok && n <= static_cast<size_t>(end - pos) / min;
+    return ok ? n : 0;
+  }
+};
+
+// Read an ebitmap, appending the bits set to bits if not null
+void readEbitmap(Reader &r, std::vector<uint32_t> *bits = nullptr) {
+  const uint32_t mapunit = r.u32();
+  r.u32();  // highbit
+  const uint32_t count = r.count(12);
+  if (mapunit != 64) {
+    r.ok = false;
+    return;
+  }
+  for (uint32_t i = 0; i < count && r.ok; ++i) {
+    const uint32_t start = r.u32();
+    uint64_t map = r.u64();
+    for (; bits && map; map &= map - 1)
+      bits->emplace_back(start + __builtin_ctzll(map));
+  }
+}
+
+void readLevel(Reader &r) {
+  r.u32();  // sensitivity
+  readEbitmap(r);
+}
+
+void readRange(Reader &r) {
+  const uint32_t items = r.u32();
+  if (items < 1 || items > 2) {
+    r.ok = false;
+    return;
+  }
+  r.skip(items * sizeof(uint32_t));
+  for (uint32_t i = 0; i < items; ++i)
+    readEbitmap(r);
+}
+
+void readContext(Reader &r, uint32_t vers) {
+  r.skip(3 * sizeof(uint32_t));  // user, role, type
+  if (vers >= kVersionMls)
+    readRange(r);
+}
+
+void readConstraints(Reader &r, uint32_t vers, uint32_t ncons) {
+  for (uint32_t i = 0; i < ncons && r.ok; ++i) {
+    r.u32();  // permissions
+    const uint32_t nexpr = r.count(12);
+    for (uint32_t j = 0; j < nexpr && r.ok; ++j) {
+      const uint32_t type = r.u32();
+      r.skip(2 * sizeof(uint32_t));  // attr, op
+      if (type != kCexprNames)
+        continue;
+      readEbitmap(r);
+      if (vers >= kVersionConstraintNames) {
+        readEbitmap(r);  // types
+        readEbitmap(r);  // negset
+        r.u32();         // flags
+      }
+    }
+  }
+}
+
+void readPerm(Reader &r, std::unordered_map<std::string, uint32_t> &perms) {
+  const uint32_t len = r.u32();
+  const uint32_t value = r.u32();
+  auto name = r.str(len);
+  if (value < 1 || value > 32)
+    r.ok = false;
+  else
+    perms[std::move(name)] = 1U << (value - 1);
+}
+
+}  // namespace
+
+bool SepolicyIndex::load(const std::string &path) {
+  struct stat st {};
+  bool ret = false;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", path.c_str());
+    return false;
+  }
+  // selinuxfs reports the size of the policy, and supports mapping it
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      ret = parse(static_cast<const uint8_t *>(data), st.st_size);
+      munmap(data, st.st_size);
+    } else {
+      PLOGE("Failed to map '%s'", path.c_str());
+    }
+  }
+  close(fd);
+  if (ret)
+    ALOGI("Indexed %zu allow rules of %zu types from '%s'", nr_rules, types.size(),
+          path.c_str());
+  else
+    ALOGE("Failed to parse policy '%s'", path.c_str());
+  return ret;
+}
+
+bool SepolicyIndex::parse(const uint8_t *data, size_t size) {
+  Reader r{data, data + size};
+  std::unordered_map<std::string, std::unordered_map<std::string, uint32_t>> commons;
+  uint32_t nr_types = 0;
+
+  if (r.u32() != kPolicyMagic || r.str(r.u32()) != kPolicyString)
+    return false;
+  const uint32_t vers = r.u32();
+  r.u32();  // config
+  const uint32_t sym_num = r.u32();
+  const uint32_t ocon_num = r.u32();
+  if (!r.ok || vers < kVersionAvtab || vers > kVersionMax) {
+    ALOGE("Unsupported policy version %u", vers);
+    return false;
+  }
+  if (vers >= kVersionPolcap)
+    readEbitmap(r);
+  if (vers >= kVersionPermissive)
+    readEbitmap(r);
+
+  // Symbol tables, only classes and types are kept
+  for (uint32_t i = 0; i < sym_num && r.ok; ++i) {
+    const uint32_t nprim = r.u32();
+    const uint32_t nel = r.count(4);
+    if (i == SYM_TYPES)
+      nr_types = std::min<uint32_t>(nprim, UINT16_MAX);
+    for (uint32_t j = 0; j < nel && r.ok; ++j) {
+      switch (i) {
+        case SYM_COMMONS: {
+          const uint32_t len = r.u32();
+          r.skip(2 * sizeof(uint32_t));  // value, nprim
+          const uint32_t nperms = r.count(8);
+          auto &perms = commons[r.str(len)];
+          for (uint32_t k = 0; k < nperms && r.ok; ++k)
+            readPerm(r, perms);
+        } break;
+        case SYM_CLASSES: {
+          const uint32_t len = r.u32();
+          const uint32_t common_len = r.u32();
+          Class cls = {static_cast<uint16_t>(r.u32()), {}};
+          r.u32();  // nprim
+          const uint32_t nperms = r.count(8);
+          const uint32_t ncons = r.count(8);
+          auto name = r.str(len);
+          if (common_len > 0) {
+            auto it = commons.find(r.str(common_len));
+            if (it != commons.end())
+              cls.perms = it->second;
+          }
+          for (uint32_t k = 0; k < nperms && r.ok; ++k)
+            readPerm(r, cls.perms);
+          readConstraints(r, vers, ncons);
+          readConstraints(r, vers, r.count(8));  // validatetrans
+          if (vers >= kVersionObjectDefaults)
+            r.skip(3 * sizeof(uint32_t));
+          if (vers >= kVersionDefaultType)
+            r.skip(sizeof(uint32_t));
+          classes.emplace(std::move(name), std::move(cls));
+        } break;
+        case SYM_ROLES: {
+          const uint32_t len = r.u32();
+          r.skip((vers >= kVersionBoundary ? 2 : 1) * sizeof(uint32_t) + len);
+          readEbitmap(r);  // dominates
+          readEbitmap(r);  // types
+        } break;
+        case SYM_TYPES: {
+          const uint32_t len = r.u32();
+          const uint32_t value = r.u32();
+          const uint32_t properties = r.u32();
+          if (vers >= kVersionBoundary)
+            r.u32();  // bounds
+          auto name = r.str(len);
+          if (value < 1 || value > UINT16_MAX) {
+            r.ok = false;
+            break;
+          }
+          if (vers >= kVersionBoundary && (properties & kTypeAttribute))
+            attributes.emplace(value);
+          types.emplace(std::move(name), value);
+        } break;
+        case SYM_USERS: {
+          const uint32_t len = r.u32();
+          r.skip((vers >= kVersionBoundary ? 2 : 1) * sizeof(uint32_t) + len);
+          readEbitmap(r);  // roles
+          readRange(r);
+          readLevel(r);
+        } break;
+        case SYM_BOOLS: {
+          r.skip(2 * sizeof(uint32_t));  // value, state
+          r.skip(r.u32());
+        } break;
+        case SYM_LEVELS: {
+          const uint32_t len = r.u32();
+          r.skip(sizeof(uint32_t) + len);  // isalias
+          readLevel(r);
+        } break;
+        case SYM_CATS: {
+          const uint32_t len = r.u32();
+          r.skip(2 * sizeof(uint32_t) + len);  // value, isalias
+        } break;
+        default:
+          r.ok = false;
+          break;
+      }
+    }
+  }
+
+  // Access vectors, unconditional then the boolean conditional lists.
+  // Only a conditional list whose expression is true now counts.
+  auto readAvtab = [&](const uint32_t nel, const bool enabled) {
+    for (uint32_t i = 0; i < nel && r.ok; ++i) {
+      const uint16_t source = r.u16();
+      const uint16_t target = r.u16();
+      const uint16_t tclass = r.u16();
+      const uint16_t specified = r.u16();
+      if (specified & kAvtabXperms) {
+        r.skip(2 + 8 * sizeof(uint32_t));  // specified, driver, perms
+        continue;
+      }
+      const uint32_t data = r.u32();
+      if (enabled && (specified & kAvtabAllowed))
+        addRule(source, target, tclass, data);
+    }
+  };
+  readAvtab(r.count(12), true);
+  const uint32_t nr_conds = r.count(8);
+  for (uint32_t i = 0; i < nr_conds && r.ok; ++i) {
+    const bool state = r.u32();
+    r.skip(r.count(8) * 2 * sizeof(uint32_t));  // expression
+    readAvtab(r.count(12), state);
+    readAvtab(r.count(12), !state);
+  }
+
+  // Skipped up to the type attribute map at the end
+  r.skip(r.count(12) * (vers >= kVersionRoleTrans ? 4 : 3) * sizeof(uint32_t));  // role_trans
+  r.skip(r.count(8) * 2 * sizeof(uint32_t));  // role_allow
+  if (vers >= kVersionFilenameTrans) {
+    const uint32_t nel = r.count(8);
+    for (uint32_t i = 0; i < nel && r.ok; ++i) {
+      r.skip(r.u32());  // name
+      if (vers < kVersionCompFilenameTrans) {
+        r.skip(4 * sizeof(uint32_t));
+        continue;
+      }
+      r.skip(2 * sizeof(uint32_t));  // ttype, tclass
+      const uint32_t ndatum = r.count(16);
+      for (uint32_t j = 0; j < ndatum && r.ok; ++j) {
+        readEbitmap(r);  // stypes
+        r.u32();         // otype
+      }
+    }
+  }
+  for (uint32_t i = 0; i < ocon_num && r.ok; ++i) {
+    const uint32_t nel = r.count(4);
+    for (uint32_t j = 0; j < nel && r.ok; ++j) {
+      switch (i) {
+        case OCON_ISID:
+          r.u32();
+          break;
+        case OCON_FS:
+        case OCON_NETIF:
+          r.skip(r.u32());
+          readContext(r, vers);
+          break;
+        case OCON_PORT:
+          r.skip(3 * sizeof(uint32_t));
+          break;
+        case OCON_NODE:
+          r.skip(2 * sizeof(uint32_t));
+          break;
+        case OCON_FSUSE: {
+          r.u32();  // behavior
+          r.skip(r.u32());
+        } break;
+        case OCON_NODE6:
+          r.skip(8 * sizeof(uint32_t));
+          break;
+        case OCON_IBPKEY:
+          r.skip(sizeof(uint64_t) + 2 * sizeof(uint32_t));
+          break;
+        case OCON_IBENDPORT: {
+          const uint32_t len = r.u32();
+          r.u32();  // port
+          r.skip(len);
+        } break;
+        default:
+          r.ok = false;
+          break;
+      }
+      readContext(r, vers);
+    }
+  }
+  const uint32_t nr_genfs = r.count(8);
+  for (uint32_t i = 0; i < nr_genfs && r.ok; ++i) {
+    r.skip(r.u32());  // fstype
+    const uint32_t nel = r.count(8);
+    for (uint32_t j = 0; j < nel && r.ok; ++j) {
+      r.skip(r.u32());  // path
+      r.u32();          // sclass
+      readContext(r, vers);
+    }
+  }
+  if (vers >= kVersionMls) {
+    const uint32_t nel = r.count(8);
+    for (uint32_t i = 0; i < nel && r.ok; ++i) {
+      r.skip((vers >= kVersionRangeTrans ? 3 : 2) * sizeof(uint32_t));
+      readRange(r);
+    }
+  }
+
+  // Attributes of each type, the bits are values - 1
+  type_attrs.assign(nr_types + 1, {});
+  for (uint32_t type = 1; type <= nr_types && r.ok; ++type) {
+    std::vector<uint32_t> bits;
+    readEbitmap(r, &bits);
+    auto &attrs = type_attrs[type];
+    attrs.emplace_back(type);
+    for (const uint32_t bit : bits) {
+      if (bit < nr_types)
+        attrs.emplace_back(bit + 1);
+    }
+    std::sort(attrs.begin(), attrs.end());
+    attrs.erase(std::unique(attrs.begin(), attrs.end()), attrs.end());
+  }
+  if (!r.ok) {
+    ALOGE("Truncated or invalid policy, version %u", vers);
+    type_attrs.clear();
+    return false;
+  }
+  return true;
+}
+
+void SepolicyIndex::addRule(uint16_t source, uint16_t target, uint16_t tclass, uint32_t perms) {
+  rules[static_cast<uint32_t>(source) << 16 | tclass].emplace_back(target, perms);
+  nr_rules++;
+}
+
+bool SepolicyIndex::isMember(uint16_t type, uint16_t attr) const {
+  const auto &attrs = type_attrs[type];
+  return std::binary_search(attrs.begin(), attrs.end(), attr);
+}
+
+SepolicyIndex::Verdict SepolicyIndex::check(const std::string &source, const std::string &target,
+                                            const std::string &tclass,
+                                            const std::vector<std::string> &perms) const {
+  const auto sit = types.find(source);
+  const auto tit = types.find(target);
+  const auto cit = classes.find(tclass);
+  if (sit == types.end() || tit == types.end() || cit == classes.end() ||
+      sit->second >= type_attrs.size() || tit->second >= type_attrs.size())
+    return UNKNOWN;
+  const auto &cls = cit->second;
+  const uint16_t src = sit->second, tgt = tit->second;
+  uint32_t want = 0, allowed = 0;
+
+  for (const auto &perm : perms) {
+    const auto it = cls.perms.find(perm);
+    if (it == cls.perms.end())
+      return UNKNOWN;
+    want |= it->second;
+  }
+
+  // As the kernel does, every attribute of the source against the target's
+  for (const uint16_t attr : type_attrs[src]) {
+    const auto it = rules.find(static_cast<uint32_t>(attr) << 16 | cls.value);
+    if (it == rules.end())
+      continue;
+    for (const auto &[rule_target, mask] : it->second) {
+      if ((mask & want & ~allowed) && isMember(tgt, rule_target)) {
+        allowed |= mask;
+        if ((allowed & want) == want)
+          return ALLOWED;
+      }
+    }
+  }
+
+  const auto nit = neverallows.find(cls.value);
+  if (nit != neverallows.end()) {
+    for (const auto &rule : nit->second) {
+      if ((rule.perms & want & ~allowed) && test(rule.sources, src) &&
+          (rule.self ? src == tgt : test(rule.targets, tgt)))
+        return NEVERALLOW;
+    }
+  }
+  return NEW;
+}
+
+SepolicyIndex::Verdict SepolicyIndex::check(const AvcContext &ctx) const {
+  return check(TrimSEContext(ctx.scontext), TrimSEContext(ctx.tcontext), ctx.tclass,
+               ctx.operation);
+}
+
+const char *SepolicyIndex::verdictName(Verdict verdict) {
+  switch (verdict) {
+    case ALLOWED:
+      return "allowed";
+    case NEW:
+      return "new";
+    case NEVERALLOW:
+      return "neverallow";
+    case UNKNOWN:
+      break;
+  }
+  return "unknown";
+}
+
+namespace {
+
+// A CIL S-expression, either an atom or a list
+struct Sexp {
+  std::string atom;
+  std::vector<Sexp> list;
+
+  bool isAtom() const { return !atom.empty(); }
+  // First atom of a list, e.g. the statement keyword
+  const std::string &head() const {
+    static const std::string kEmpty;
+    return !list.empty() ? list.front().atom : kEmpty;
+  }
+};
+
+// Parses the statements of a CIL file one by one
+struct CilParser {
+  std::string_view text;
+  size_t pos = 0;
+
+  // Skip blanks and comments, return the next character or 0 at the end
+  char peek() {
+    while (pos < text.size()) {
+      if (text[pos] == ';') {
+        pos = text.find('\n', pos);
+        if (pos == std::string_view::npos)
+          pos = text.size();
+      } else if (isspace(static_cast<unsigned char>(text[pos]))) {
+        pos++;
+      } else {
+        return text[pos];
+      }
+    }
+    return 0;
+  }
+
+  std::string atom() {
+    const size_t start = pos;
+    if (text[pos] == '"') {
+      pos = text.find('"', pos + 1);
+      pos = pos == std::string_view::npos ? text.size() : pos + 1;
+    } else {
+      while (pos < text.size() && text[pos] != '(' && text[pos] != ')' && text[pos] != ';' &&
+             !isspace(static_cast<unsigned char>(text[pos])))
+        pos++;
+    }
+    return std::string(text.substr(start, pos - start));
+  }
+
+  // Parse one expression, false at the end or on unbalanced parentheses
+  bool parse(Sexp &out) {
+    const char c = peek();
+    if (c == 0 || c == ')')
+      return false;
+    if (c != '(') {
+      out.atom = atom();
+      return true;
+    }
+    pos++;
+    while (peek() != ')') {
+      if (pos >= text.size())
+        return false;
+      out.list.emplace_back();
+      if (!parse(out.list.back()))
+        return false;
+    }
+    pos++;
+    return true;
+  }
+
+  // Skip the rest of a statement whose '(' and keyword were consumed
+  void skipStatement() {
+    for (int depth = 1; depth > 0 && peek() != 0;) {
+      if (text[pos] == '(')
+        depth++, pos++;
+      else if (text[pos] == ')')
+        depth--, pos++;
+      else
+        atom();
+    }
+  }
+};
+
+}  // namespace
+
+int SepolicyIndex::loadNeverallows(const std::string &path) {
+  std::string text;
+  std::unordered_map<std::string, std::vector<Sexp>> attributeSets;
+  std::vector<Sexp> statements;
+
+  if (type_attrs.empty())
+    return -1;
+  if (!ReadFileToString(path, &text))
+    return -1;
+
+  // Only typeattributeset and neverallow statements are of interest
+  CilParser parser{text};
+  while (parser.peek() == '(') {
+    const size_t start = parser.pos++;
+    parser.peek();
+    const auto keyword = parser.atom();
+    if (keyword != "typeattributeset" && keyword != "neverallow") {
+      parser.skipStatement();
+      continue;
+    }
+    parser.pos = start;
+    Sexp stmt;
+    if (!parser.parse(stmt)) {
+      ALOGE("Unbalanced statement in '%s' at offset %zu", path.c_str(), start);
+      return -1;
+    }
+    if (keyword == "typeattributeset" && stmt.list.size() == 3 && stmt.list[1].isAtom())
+      attributeSets[stmt.list[1].atom].emplace_back(std::move(stmt.list[2]));
+    else if (keyword == "neverallow" && stmt.list.size() == 4)
+      statements.emplace_back(std::move(stmt));
+  }
+
+  // Types of the binary policy are 1 .. type_attrs.size() - 1
+  const size_t words = (type_attrs.size() + 63) / 64;
+  Bitset allTypes(words);
+  std::vector<std::vector<uint16_t>> attrTypes(type_attrs.size());
+  for (size_t type = 1; type < type_attrs.size(); ++type) {
+    if (attributes.count(type))
+      continue;
+    allTypes[type / 64] |= 1ULL << (type % 64);
+    for (const uint16_t attr : type_attrs[type])
+      attrTypes[attr].emplace_back(type);
+  }
+
+  std::unordered_map<std::string, Bitset> resolved;
+  std::set<std::string> resolving;
+  std::function<Bitset(const Sexp &)> eval;
+  // Types of a name: from the binary policy, else a typeattributeset
+  auto resolve = [&](const std::string &name) {
+    auto it = resolved.find(name);
+    if (it != resolved.end())
+      return it->second;
+    Bitset set(words);
+    const auto tit = types.find(name);
+    const auto ait = attributeSets.find(name);
+    if (tit != types.end() && tit->second < type_attrs.size()) {
+      // A type is in its own list
+      for (const uint16_t type : attrTypes[tit->second])
+        set[type / 64] |= 1ULL << (type % 64);
+    } else if (ait != attributeSets.end() && resolving.insert(name).second) {
+      for (const auto &expr : ait->second) {
+        const auto members = eval(expr);
+        for (size_t i = 0; i < words; ++i)
+          set[i] |= members[i];
+      }
+      resolving.erase(name);
+    }
+    // Only attributes, types are cheap to resolve again
+    if (ait != attributeSets.end() || (tit != types.end() && attributes.count(tit->second)))
+      resolved.emplace(name, set);
+    return set;
+  };
+  eval = [&](const Sexp &expr) {
+    if (expr.isAtom())
+      return resolve(expr.atom);
+    const auto &op = expr.head();
+    Bitset set(words);
+    if (op == "all")
+      return allTypes;
+    if (op == "not" && expr.list.size() == 2) {
+      const auto operand = eval(expr.list[1]);
+      for (size_t i = 0; i < words; ++i)
+        set[i] = allTypes[i] & ~operand[i];
+      return set;
+    }
+    if ((op == "and" || op == "or" || op == "xor") && expr.list.size() == 3) {
+      const auto a = eval(expr.list[1]), b = eval(expr.list[2]);
+      for (size_t i = 0; i < words; ++i)
+        set[i] = op == "and" ? a[i] & b[i] : op == "or" ? a[i] | b[i] : a[i] ^ b[i];
+      return set;
+    }
+    // A plain list of names
+    for (const auto &item : expr.list) {
+      const auto members = eval(item);
+      for (size_t i = 0; i < words; ++i)
+        set[i] |= members[i];
+    }
+    return set;
+  };
+
+  // (neverallow source target (class (perms)))
+  int added = 0;
+  for (const auto &stmt : statements) {
+    const auto &classPerms = stmt.list[3];
+    if (classPerms.list.size() != 2 || !classPerms.list[0].isAtom())
+      continue;
+    const auto cit = classes.find(classPerms.list[0].atom);
+    if (cit == classes.end())
+      continue;
+    const auto &cls = cit->second;
+    uint32_t perms = 0;
+    const auto &permList = classPerms.list[1];
+    if (permList.head() == "all" || (permList.isAtom() && permList.atom == "all")) {
+      perms = UINT32_MAX;
+    } else {
+      bool negate = permList.head() == "not" && permList.list.size() == 2;
+      for (const auto &perm : negate ? permList.list[1].list : permList.list) {
+        const auto pit = cls.perms.find(perm.atom);
+        if (pit != cls.perms.end())
+          perms |= pit->second;
+      }
+      if (negate)
+        perms = ~perms;
+    }
+    Neverallow rule = {eval(stmt.list[1]), {}, stmt.list[2].atom == "self", perms};
+    if (!rule.self)
+      rule.targets = eval(stmt.list[2]);
+    if (perms != 0) {
+      neverallows[cls.value].emplace_back(std::move(rule));
+      added++;
+    }
+  }
+  nr_neverallows += added;
+  ALOGI("Loaded %d neverallow rules from '%s'", added, path.c_str());
+  return added;
+}
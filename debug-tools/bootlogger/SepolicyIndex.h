@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+// Loaded policy of the running kernel
+static constexpr char kKernelPolicyPath[] = "/sys/fs/selinux/policy";
+
+/**
+ * Index of a binary (kernel format) SELinux policy, to tell whether a rule
+ * is allowed already.
+ *
+ * The policy is mapped and parsed once. Only the type, class and access
+ * vector tables are kept, with the allow rules keyed by source type and
+ * class. Attributes are expanded through the policy's type attribute map
+ * at lookup. Conditional rules count if their boolean expression is
+ * currently true.
+ *
+ * Neverallows are checked at build time and are not part of a binary
+ * policy, they are read from CIL files (e.g. plat_sepolicy.cil) instead.
+ */
+struct SepolicyIndex {
+  enum Verdict {
+    ALLOWED,     // Every permission is allowed already
+    NEW,         // Some permission is not allowed
+    NEVERALLOW,  // Some permission conflicts with a neverallow
+    UNKNOWN,     // Type, class or permission not in the policy
+  };
+
+  /**
+   * Load a binary policy
+   *
+   * @param path e.g. kKernelPolicyPath
+   * @return true on success
+   */
+  bool load(const std::string &path);
+
+  /**
+   * Add the neverallow rules of a CIL policy file. Their source and target
+   * may be types or attributes of the binary policy, or attributes defined
+   * by typeattributeset in the file.
+   *
+   * @param path the CIL file
+   * @return number of neverallows added, -1 if the file cannot be read
+   */
+  int loadNeverallows(const std::string &path);
+
+  /**
+   * Classify a rule
+   *
+   * @param source source type
+   * @param target target type
+   * @param tclass class
+   * @param perms permissions
+   * @return the verdict
+   */
+  Verdict check(const std::string &source, const std::string &target, const std::string &tclass,
+                const std::vector<std::string> &perms) const;
+
+  /**
+   * Classify the rule of a context, see check()
+   */
+  Verdict check(const AvcContext &ctx) const;
+
+  static const char *verdictName(Verdict verdict);
+
+  // Number of allow rules indexed
+  size_t getRules() const { return nr_rules; }
+
+  // Number of neverallow rules loaded
+  size_t getNeverallows() const { return nr_neverallows; }
+
+ private:
+  struct Class {
+    uint16_t value;
+    std::unordered_map<std::string, uint32_t> perms;  // Name to bit
+  };
+  struct Neverallow {
+    std::vector<uint64_t> sources, targets;  // Bitsets of type values
+    bool self;                               // Target is the source itself
+    uint32_t perms;
+  };
+  using Bitset = std::vector<uint64_t>;
+
+  bool parse(const uint8_t *data, size_t size);
+  void addRule(uint16_t source, uint16_t target, uint16_t tclass, uint32_t perms);
+  bool isMember(uint16_t type, uint16_t attr) const;
+  static bool test(const Bitset &set, uint16_t value) {
+    return value / 64 < set.size() && (set[value / 64] >> (value % 64)) & 1;
+  }
+
+  std::unordered_map<std::string, uint16_t> types;
+  std::unordered_map<std::string, Class> classes;
+  std::unordered_set<uint16_t> attributes;
+  // Sorted attributes of each type including itself, by value
+  std::vector<std::vector<uint16_t>> type_attrs;
+  // (source << 16 | class) to the targets and permissions allowed
+  std::unordered_map<uint32_t, std::vector<std::pair<uint16_t, uint32_t>>> rules;
+  // Class value to its neverallows
+  std::unordered_map<uint16_t, std::vector<Neverallow>> neverallows;
+  size_t nr_rules = 0;
+  size_t nr_neverallows = 0;
+};
@@ -0,0 +1,238 @@
+#include <cutils/sockets.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "LoggerInternal.h"
+#include "ResourceGovernor.h"
+#include "StreamServer.h"
+
+void StreamSink::publish(const char *data, size_t len) {
+  std::unique_lock<std::mutex> guard(lock);
+  bool wake = false;
+
+  for (auto &client : clients) {
+    const size_t need = len + 1;
+    auto room = [this, &client, need] {
+      return client->gone || client->buf.size() - client->offset + need <= server->buffer_size;
+    };
+    if (!room() && client->block && !client->stalled) {
+      waiters++;
+      client->stalled = !space.wait_for(guard, server->block_timeout, room);
+      waiters--;
+    }
+    if (client->gone)
+      continue;
+    if (!room()) {
+      client->dropped++;
+      nr_dropped++;
+      continue;
+    }
+    // Compact once the sent part dominates
+    if (client->offset > client->buf.size() / 2) {
+      client->buf.erase(0, client->offset);
+      client->offset = 0;
+    }
+    wake |= client->buf.size() == client->offset;
+    if (client->dropped > 0) {
+      client->buf += "--- " + std::to_string(client->dropped) + " lines dropped ---\n";
+      client->dropped = 0;
+    }
+    client->buf.append(data, len);
+    client->buf.push_back('\n');
+  }
+  guard.unlock();
+  // Only when a buffer was empty, the server thread is busy otherwise
+  if (wake)
+    server->wake();
+}
+
+StreamServer::StreamServer(size_t buffer_size, std::chrono::milliseconds block_timeout)
+    : buffer_size(buffer_size), block_timeout(block_timeout) {}
+
+StreamSink *StreamServer::add(const std::string &name) {
+  auto [it, _] = sinks.try_emplace(name, std::make_unique<StreamSink>(this, name));
+  return it->second.get();
+}
+
+bool StreamServer::start(std::atomic_bool *run) {
+  sockfd = android_get_control_socket(kStreamSocketName);
+  if (sockfd < 0) {
+    ALOGW("No '%s' socket from init, outputs are not streamed", kStreamSocketName);
+    return false;
+  }
+  if (listen(sockfd, 4) < 0) {
+    PLOGE("listen");
+    return false;
+  }
+  eventfd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (eventfd < 0) {
+    PLOGE("eventfd");
+    return false;
+  }
+  thread = std::thread([this, run] { serve(run); });
+  return true;
+}
+
+void StreamServer::wake(void) {
+  const uint64_t one = 1;
+  if (eventfd >= 0)
+    write(eventfd, &one, sizeof(one));
+}
+
+// How long a new connection may take to send its hello
+static constexpr std::chrono::seconds kHelloTimeout(1);
+
+void StreamServer::accept(void) {
+  int client = accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (client < 0) {
+    PLOGE("accept4");
+    return;
+  }
+  hellos.push_back({client, std::chrono::steady_clock::now() + kHelloTimeout});
+}
+
+void StreamServer::subscribe(int client) {
+  char hello[128] = {0};
+
+  ssize_t len = recv(client, hello, sizeof(hello) - 1, MSG_DONTWAIT);
+  std::string line(hello, len > 0 ? strnlen(hello, len) : 0);
+  while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+    line.pop_back();
+  const auto sep = line.find(' ');
+  const auto name = line.substr(0, sep);
+  const auto policy = sep == std::string::npos ? "drop" : line.substr(sep + 1);
+
+  auto it = sinks.find(name);
+  if (it == sinks.end() || (policy != "drop" && policy != "block")) {
+    const std::string err = "ERROR unknown stream or policy '" + line + "'\n";
+    send(client, err.data(), err.size(), MSG_NOSIGNAL);
+    close(client);
+    return;
+  }
+  ALOGD("%s: Streaming '%s' (%s)", __func__, name.c_str(), policy.c_str());
+  auto entry = std::make_unique<StreamSink::Client>();
+  entry->fd = client;
+  entry->block = policy == "block";
+  entry->buf.reserve(buffer_size);
+  const std::lock_guard<std::mutex> _(it->second->lock);
+  it->second->joining.emplace_back(std::move(entry));
+  it->second->nr_clients++;
+}
+
+bool StreamServer::flush(StreamSink &sink, StreamSink::Client &client) {
+  while (client.offset < client.buf.size()) {
+    ssize_t len = send(client.fd, client.buf.data() + client.offset,
+                       client.buf.size() - client.offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (len < 0)
+      return errno == EAGAIN || errno == EINTR;
+    client.offset += len;
+  }
+  client.buf.clear();
+  client.offset = 0;
+  // Caught up, block again
+  client.stalled = false;
+  sink.space.notify_all();
+  return true;
+}
+
+void StreamServer::serve(std::atomic_bool *run) {
+  std::vector<struct pollfd> pfds;
+  std::vector<std::pair<StreamSink *, StreamSink::Client *>> owners;
+
+  ResourceGovernor::get().applyThread(ResourceGovernor::BACKGROUND);
+  while (*run) {
+    pfds = {{sockfd, POLLIN, 0}, {eventfd, POLLIN, 0}};
+    const auto now = std::chrono::steady_clock::now();
+    hellos.erase(std::remove_if(hellos.begin(), hellos.end(),
+                                [now](const Hello &h) {
+                                  if (now < h.deadline)
+                                    return false;
+                                  close(h.fd);
+                                  return true;
+                                }),
+                 hellos.end());
+    for (const auto &hello : hellos)
+      pfds.push_back({hello.fd, POLLIN, 0});
+    const size_t first_client = pfds.size();
+    owners.clear();
+    for (auto &[_, sink] : sinks) {
+      const std::lock_guard<std::mutex> guard(sink->lock);
+      if (sink->waiters == 0) {
+        auto &vec = sink->clients;
+        vec.erase(std::remove_if(vec.begin(), vec.end(), [](const auto &c) { return c->gone; }),
+                  vec.end());
+        for (auto &client : sink->joining)
+          vec.emplace_back(std::move(client));
+        sink->joining.clear();
+      }
+      for (auto &client : sink->clients) {
+        if (client->gone)
+          continue;
+        const bool pending = client->offset < client->buf.size();
+        pfds.push_back({client->fd, static_cast<short>(POLLRDHUP | (pending ? POLLOUT : 0)), 0});
+        owners.emplace_back(sink.get(), client.get());
+      }
+    }
+    if (poll(pfds.data(), pfds.size(), 200) <= 0)
+      continue;
+    if (pfds[1].revents & POLLIN) {
+      uint64_t count;
+      read(eventfd, &count, sizeof(count));
+    }
+    // Backwards, so erasing keeps the remaining indices valid
+    for (size_t i = first_client; i-- > 2;) {
+      if (pfds[i].revents == 0)
+        continue;
+      subscribe(pfds[i].fd);
+      hellos.erase(hellos.begin() + (i - 2));
+    }
+    if (pfds[0].revents & POLLIN)
+      accept();
+    for (size_t i = 0; i < owners.size(); ++i) {
+      auto [sink, client] = owners[i];
+      const auto revents = pfds[i + first_client].revents;
+      const std::lock_guard<std::mutex> guard(sink->lock);
+      bool alive = !(revents & (POLLRDHUP | POLLHUP | POLLERR));
+      if (alive && (revents & POLLOUT))
+        alive = flush(*sink, *client);
+      if (!alive) {
+        close(client->fd);
+        client->fd = -1;
+        client->gone = true;
+        client->buf.clear();
+        client->offset = 0;
+        sink->space.notify_all();
+      }
+    }
+  }
+}
+
+void StreamServer::getStats(std::vector<std::string> &out) const {
+  for (const auto &[name, sink] : sinks) {
+    if (sink->nr_clients > 0)
+      out.emplace_back("stream " + name + ": " + std::to_string(sink->nr_clients.load()) +
+                       " clients, " + std::to_string(sink->nr_dropped.load()) + " lines dropped");
+  }
+}
+
+StreamServer::~StreamServer() {
+  if (thread.joinable())
+    thread.join();
+  for (auto &[_, sink] : sinks) {
+    for (auto *vec : {&sink->clients, &sink->joining}) {
+      for (auto &client : *vec) {
+        if (client->fd >= 0)
+          close(client->fd);
+      }
+    }
+  }
+  for (const auto &hello : hellos)
+    close(hello.fd);
+  if (eventfd >= 0)
+    close(eventfd);
+}
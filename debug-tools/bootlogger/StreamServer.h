@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Name of the init-created socket streaming the outputs
+static constexpr char kStreamSocketName[] = "logger_stream";
+
+struct StreamServer;
+
+/**
+ * Streams the records of one output (a context or a filter) to the
+ * clients subscribed to it.
+ *
+ * Each client has a bounded buffer, drained by the server thread.
+ * When it is full, records are dropped for that client, or with the
+ * block policy the writer waits for room up to a limit. After a timeout
+ * the client is dropped for until its buffer drained, so a stalled client
+ * costs capture one timeout, not one per record.
+ */
+struct StreamSink {
+  /**
+   * Queue a record to every client, called by the output's writer
+   *
+   * @param data the record, not new line terminated
+   * @param len length of data
+   */
+  void publish(const char *data, size_t len);
+
+  // Only created by StreamServer::add()
+  StreamSink(StreamServer *server, const std::string &name) : server(server), name(name) {}
+
+ private:
+  friend struct StreamServer;
+
+  struct Client {
+    int fd = -1;
+    bool block = false;
+    std::string buf;  // Pending bytes, from offset on
+    size_t offset = 0;
+    uint64_t dropped = 0;  // Not yet reported to the client
+    bool stalled = false;  // Blocking timed out, dropping until drained
+    bool gone = false;     // Disconnected, to be removed
+  };
+
+  StreamServer *server;
+  std::string name;
+  std::mutex lock;
+  std::condition_variable space;
+  std::vector<std::unique_ptr<Client>> clients;
+  // Clients are only added and removed while no writer is waiting on
+  // space, as that one is iterating clients
+  std::vector<std::unique_ptr<Client>> joining;
+  unsigned waiters = 0;
+  std::atomic_uint64_t nr_clients = 0;
+  std::atomic_uint64_t nr_dropped = 0;
+};
+
+/**
+ * Serves the output streams over the init-created unix socket.
+ * A client sends "NAME [drop|block]" (e.g. "avc.logcat block"), and then
+ * receives the records of that output as they are written, new line
+ * terminated. Dropped records are replaced by a "--- N lines dropped ---"
+ * line once there is room again.
+ */
+struct StreamServer {
+  /**
+   * @param buffer_size per client buffer size in bytes
+   * @param block_timeout longest time a writer waits for a blocking client,
+   *        which is then dropped for until it caught up
+   */
+  StreamServer(size_t buffer_size, std::chrono::milliseconds block_timeout);
+
+  /**
+   * Create the sink of an output, must be done before start()
+   *
+   * @param name the name clients subscribe with
+   * @return the sink, owned by the server
+   */
+  StreamSink *add(const std::string &name);
+
+  /**
+   * Start serving in a new thread
+   *
+   * @param run Pointer to run/stop control variable
+   * @return true if the socket was available
+   */
+  bool start(std::atomic_bool *run);
+
+  // Append statistics of each stream
+  void getStats(std::vector<std::string> &out) const;
+
+  ~StreamServer();
+
+ private:
+  friend struct StreamSink;
+
+  void serve(std::atomic_bool *run);
+  // Accept a connection, its hello is read once it arrives
+  void accept(void);
+  // Read the hello of a new connection and subscribe it to its stream
+  void subscribe(int client);
+  // Send what is pending, false if the client is gone
+  bool flush(StreamSink &sink, StreamSink::Client &client);
+  // Wake the server thread up
+  void wake(void);
+
+  size_t buffer_size;
+  std::chrono::milliseconds block_timeout;
+  int sockfd = -1;
+  int eventfd = -1;
+  std::map<std::string, std::unique_ptr<StreamSink>> sinks;
+  // Connections that did not send their hello yet, and until when they may
+  struct Hello {
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  std::vector<Hello> hellos;
+  std::thread thread;
+};
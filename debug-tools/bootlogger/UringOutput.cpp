@@ -0,0 +1,231 @@
+#include <fcntl.h>
+#include <liburing.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "LoggerInternal.h"
+#include "OutputContext.h"
+
+// Entries needed: A fallocate, a write and a sync for each buffer
+static constexpr unsigned kRingEntries = 32;
+
+UringOutputBackend::UringOutputBackend() = default;
+
+bool UringOutputBackend::open(const std::string &path) {
+  if (!FileOutputBackend::open(path))
+    return false;
+  offset = bytes;
+  // Reopened by rotate(), keep the ring
+  if (ring)
+    return true;
+
+  auto uring = std::make_unique<struct io_uring>();
+  int rc = io_uring_queue_init(kRingEntries, uring.get(), 0);
+  if (rc < 0) {
+    // ENOSYS on old kernels, EPERM if blocked by seccomp or SELinux
+    ALOGW("io_uring unavailable for '%s': %s, using write(2)", path.c_str(), strerror(-rc));
+    return true;
+  }
+  ring = std::move(uring);
+  for (auto &buf : buffers)
+    buf.data.reserve(kBufferSize);
+  return true;
+}
+
+void UringOutputBackend::reap(bool wait) {
+  struct io_uring_cqe *cqe;
+
+  // Peeking the completion queue does not need a syscall
+  while (pending > 0) {
+    int rc = io_uring_peek_cqe(ring.get(), &cqe);
+    if (rc == -EAGAIN && wait) {
+      rc = io_uring_wait_cqe(ring.get(), &cqe);
+      nr_syscalls++;
+    }
+    if (rc < 0)
+      break;
+    if (cqe->res < 0)
+      ALOGE("io_uring request on fd %d failed: %s", fd, strerror(-cqe->res));
+    // Only writes carry a buffer
+    if (cqe->user_data < kNumBuffers) {
+      auto &buf = buffers[cqe->user_data];
+      max_io_latency = std::max(max_io_latency, std::chrono::steady_clock::now() - buf.submitted);
+      buf.inflight = false;
+      buf.data.clear();
+    } else if (cqe->user_data == kRetire) {
+      // Everything written to the rotated file is done
+      closeFile(retired_fd, retired_preallocated);
+      retired_fd = -1;
+    }
+    io_uring_cqe_seen(ring.get(), cqe);
+    pending--;
+    wait = false;
+  }
+}
+
+void UringOutputBackend::submit(void) {
+  auto &buf = buffers[current];
+  struct io_uring_sqe *sqe;
+  unsigned nr_sqes = 0;
+
+  if (buf.data.empty())
+    return;
+
+  // Writes of different buffers may complete out of order, each one lands
+  // at its own offset. Everything accounted so far is either submitted or
+  // in this buffer.
+  auto range = preallocate(0);
+  if (range.second > 0) {
+    sqe = io_uring_get_sqe(ring.get());
+    io_uring_prep_fallocate(sqe, fd, FALLOC_FL_KEEP_SIZE, range.first, range.second);
+    io_uring_sqe_set_data64(sqe, kNoBuffer);
+    // A failed preallocation must not cancel the write
+    sqe->flags |= IOSQE_IO_HARDLINK;
+    nr_sqes++;
+  }
+  sqe = io_uring_get_sqe(ring.get());
+  io_uring_prep_write(sqe, fd, buf.data.data(), buf.data.size(), offset);
+  io_uring_sqe_set_data64(sqe, current);
+  nr_sqes++;
+  len += buf.data.size();
+  if (syncDue(len)) {
+    sqe = io_uring_get_sqe(ring.get());
+    switch (DurabilityPolicy::get().mode) {
+      case DurabilityPolicy::RANGE:
+        io_uring_prep_sync_file_range(sqe, fd, offset + buf.data.size() - synced, synced,
+                                      SYNC_FILE_RANGE_WRITE);
+        break;
+      case DurabilityPolicy::DATASYNC:
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        break;
+      default:
+        io_uring_prep_fsync(sqe, fd, 0);
+        break;
+    }
+    io_uring_sqe_set_data64(sqe, kNoBuffer);
+    // Only start once every earlier write is done, not just this one
+    sqe->flags |= IOSQE_IO_DRAIN;
+    nr_sqes++;
+    synced = offset + buf.data.size();
+    len = 0;
+    nr_syncs++;
+  }
+
+  buf.submitted = std::chrono::steady_clock::now();
+  int rc = io_uring_submit(ring.get());
+  nr_syscalls++;
+  if (rc < 0) {
+    ALOGE("io_uring_submit on fd %d failed: %s", fd, strerror(-rc));
+    buf.data.clear();
+    return;
+  }
+  buf.inflight = true;
+  pending += nr_sqes;
+  offset += buf.data.size();
+
+  // Move onto a free buffer, only block if every buffer is in flight
+  reap(false);
+  for (size_t i = 1; i <= kNumBuffers; ++i) {
+    size_t next = (current + i) % kNumBuffers;
+    if (!buffers[next].inflight) {
+      current = next;
+      return;
+    }
+  }
+  ALOGW("All io_uring buffers of fd %d are in flight, waiting", fd);
+  while (buffers[(current + 1) % kNumBuffers].inflight)
+    reap(true);
+  current = (current + 1) % kNumBuffers;
+}
+
+void UringOutputBackend::write(const char *data, size_t size) {
+  if (!ring) {
+    FileOutputBackend::write(data, size);
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  if (buffers[current].data.size() + size + 1 > kBufferSize)
+    submit();
+  account(size + 1);
+  auto &buf = buffers[current].data;
+  buf.insert(buf.end(), data, data + size);
+  buf.emplace_back('\n');
+  max_call_latency = std::max(max_call_latency, std::chrono::steady_clock::now() - start);
+}
+
+bool UringOutputBackend::empty() const {
+  if (!ring)
+    return FileOutputBackend::empty();
+  return offset == 0 && buffers[current].data.empty();
+}
+
+void UringOutputBackend::drain(void) {
+  submit();
+  while (pending > 0)
+    reap(true);
+}
+
+void UringOutputBackend::flush() {
+  if (ring)
+    drain();
+  FileOutputBackend::flush();
+}
+
+bool UringOutputBackend::rotate(const std::string &path, const std::string &rotated) {
+  struct io_uring_sqe *sqe;
+
+  if (!ring)
+    return FileOutputBackend::rotate(path, rotated);
+
+  submit();
+  // Only one rotated file is tracked, rotations are far apart anyway
+  while (retired_fd >= 0)
+    reap(true);
+  // Sync the old file once its writes are done, reap() closes it after
+  sqe = io_uring_get_sqe(ring.get());
+  if (DurabilityPolicy::get().mode == DurabilityPolicy::NONE)
+    io_uring_prep_nop(sqe);
+  else
+    io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+  io_uring_sqe_set_data64(sqe, kRetire);
+  sqe->flags |= IOSQE_IO_DRAIN;
+  int rc = io_uring_submit(ring.get());
+  nr_syscalls++;
+  if (rc < 0) {
+    ALOGE("io_uring_submit on fd %d failed: %s", fd, strerror(-rc));
+    drain();
+    return FileOutputBackend::rotate(path, rotated);
+  }
+  pending++;
+  nr_syncs++;
+
+  logStats();
+  retired_fd = fd;
+  retired_preallocated = allocated > static_cast<off_t>(bytes) && allocated != INT64_MAX;
+  // Only closes the index now
+  fd = -1;
+  close();
+  return renameClosed(path, rotated) && open(path);
+}
+
+ssize_t UringOutputBackend::splice(int pipe_fd, size_t size) {
+  if (!ring)
+    return FileOutputBackend::splice(pipe_fd, size);
+  // Ring writes use offsets, the file position is not kept up to date
+  drain();
+  if (lseek(fd, offset, SEEK_SET) < 0)
+    return -1;
+  nr_syscalls++;
+  const ssize_t n = FileOutputBackend::splice(pipe_fd, size);
+  if (n > 0)
+    offset += n;
+  return n;
+}
+
+UringOutputBackend::~UringOutputBackend() {
+  if (ring) {
+    drain();
+    io_uring_queue_exit(ring.get());
+  }
+}